@@ -10,14 +10,20 @@
 #include <climits>
 #include <cstring>
 #include <cfloat>
+#include <cmath>
 #include <complex>
 #include <cstdlib>
 #include <iostream>
 #include <map>
 #include <string>
+#include <sys/stat.h>
 
+#include "../include/compressed_data.h"
+#include "../include/csr_data.h"
+#include "../include/feature_map.h"
 #include "../include/network.h"
 #include "../include/progress_bar.h"
+#include "../include/xml_data.h"
 
 int *RangePow;
 int *K;
@@ -25,6 +31,18 @@ int *L;
 float *Sparsity;
 
 bool has_header = true;
+bool BinaryCache = false;
+bool InMemory = false;
+bool Compressed = false;
+bool HalfValues = false;
+bool Minibatch = false;
+bool Int8 = false;
+bool FastScan = false;
+int TopKSize = 0;
+float TopMass = 1;
+int EvalSamples = 0;
+int EvalBudget = 0;
+int MinFeatureCount = 0;
 int Batchsize = 1000;
 int Rehash = 1000;
 int Rebuild = 1000;
@@ -32,6 +50,8 @@ int InputDim = 784;
 int totRecords = 60000;
 int totRecordsTest = 10000;
 float Lr = 0.0001;
+string Method = "SGD";
+string Storage = "fp32";
 int Epoch = 5;
 int Stepsize = 20;
 int *sizesOfLayers;
@@ -224,6 +244,62 @@ void parseconfig(string filename)
       string str = trim(second).c_str();
       has_header = atoi(str.c_str()) > 0;
     }
+    else if (trim(first) == "BinaryCache")
+    {
+      BinaryCache = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "InMemory")
+    {
+      InMemory = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "Compressed")
+    {
+      Compressed = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "HalfValues")
+    {
+      HalfValues = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "Precision")
+    {
+      Storage = trim(second);
+    }
+    else if (trim(first) == "Optimizer")
+    {
+      Method = trim(second);
+    }
+    else if (trim(first) == "Int8")
+    {
+      Int8 = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "FastScan")
+    {
+      FastScan = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "TopK")
+    {
+      TopKSize = atoi(trim(second).c_str());
+    }
+    else if (trim(first) == "TopMass")
+    {
+      TopMass = atof(trim(second).c_str());
+    }
+    else if (trim(first) == "Minibatch")
+    {
+      Minibatch = atoi(trim(second).c_str()) > 0;
+    }
+    else if (trim(first) == "EvalSamples")
+    {
+      EvalSamples = atoi(trim(second).c_str());
+    }
+    else if (trim(first) == "EvalBudget")
+    {
+      EvalBudget = atoi(trim(second).c_str());
+    }
+    else if (trim(first) == "MinFeatureCount")
+    {
+      MinFeatureCount = atoi(trim(second).c_str());
+    }
     else
     {
       cout << "Error Parsing conf File at Line" << endl;
@@ -232,213 +308,188 @@ void parseconfig(string filename)
   }
 }
 
-void EvalDataSVM(int numBatchesTest,  Network* _mynet, int iter){
-  int totCorrect = 0;
-  int debugnumber = 0;
-  std::ifstream testfile(testData);
-  string str;
-  //Skipe header
-  if (has_header)
-    std::getline( testfile, str );
-
-  ProgressBar progress_bar(numBatchesTest, "Testing");
-  ofstream outputFile(logFile,  std::ios_base::app);
-  for (size_t i = 0; i < numBatchesTest; i++, ++progress_bar) {
-    int **records = new int *[Batchsize];
-    float **values = new float *[Batchsize];
-    int *sizes = new int[Batchsize];
-    int **labels = new int *[Batchsize];
-    int *labelsize = new int[Batchsize];
-    int nonzeros = 0;
-    int count = 0;
-    vector<string> list;
-    vector<string> value;
-    vector<string> label;
-    while (std::getline(testfile, str)) {
+void ReadDataSVM(int numBatches,  Network* _mynet, int epoch,
+                 const string& source, const FeatureMap* featureMap){
+  // the next batches are parsed in background while training on this one
+  SparseData file(source, Batchsize, has_header, numBatches,
+                  2, 1 << 24, featureMap);
+  CSRView view;
 
-      char *mystring = &str[0];
-      char *pch, *pchlabel;
-      int track = 0;
-      list.clear();
-      value.clear();
-      label.clear();
-      pch = strtok(mystring, " ");
-      pch = strtok(NULL, " :");
-      while (pch != NULL) {
-        if (track % 2 == 0)
-          list.push_back(pch);
-        else if (track%2==1)
-          value.push_back(pch);
-        track++;
-        pch = strtok(NULL, " :");
-      }
-
-      pchlabel = strtok(mystring, ",");
-      while (pchlabel != NULL) {
-        label.push_back(pchlabel);
-        pchlabel = strtok(NULL, ",");
-      }
-
-      nonzeros += list.size();
-      records[count] = new int[list.size()];
-      values[count] = new float[list.size()];
-      labels[count] = new int[label.size()];
-      sizes[count] = list.size();
-      labelsize[count] = label.size();
-
-      int currcount = 0;
-      debugnumber++;
-      vector<string>::iterator it;
-      for (it = list.begin(); it < list.end(); it++) {
-        records[count][currcount] = stoi(*it);
-        currcount++;
-      }
-      currcount = 0;
-      for (it = value.begin(); it < value.end(); it++) {
-        values[count][currcount] = stof(*it);
-        currcount++;
-      }
-      currcount = 0;
-      for (it = label.begin(); it < label.end(); it++) {
-        int l = stoi(*it);
-        labels[count][currcount] = l > 0 ?  l : 0;
-        currcount++;
-      }
-
-      count++;
-      if (count >= Batchsize)
-        break;
-    }
+  ProgressBar progress_bar(numBatches, "Training epoch " + to_string(epoch));
+  for (size_t i = 0; i < numBatches && file.nextBatch(view);
+       i++, ++progress_bar) {
+    auto t1 = std::chrono::high_resolution_clock::now();
 
-    int num_features = 0, num_labels = 0;
-    for (int i = 0; i < Batchsize; i++)
-    {
-      num_features += sizes[i];
-      num_labels += labelsize[i];
-    }
 
-//    std::cout << Batchsize << " records, with "<< num_features << " features and " << num_labels << " labels" << std::endl;
-    auto correctPredict = _mynet->predict(records, values, sizes, labels, labelsize);
-    totCorrect += correctPredict;
-//    std::cout <<" iter "<< i << ": " << totCorrect*1.0/(Batchsize*(i+1)) << " correct" << std::endl;
+    auto loss = _mynet->train(view);
 
-    delete[] sizes;
-    delete[] labels;
-    for (size_t d = 0; d < Batchsize; d++) {
-      delete[] records[d];
-      delete[] values[d];
-    }
-    delete[] records;
-    delete[] values;
+    auto t2 = std::chrono::high_resolution_clock::now();
 
+    int timeDiffInMiliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
+    globalTime+= timeDiffInMiliseconds;
   }
-  testfile.close();
-  cout << "over all " << totCorrect * 1.0 / (numBatchesTest*Batchsize) << endl;
-  outputFile << iter << " " << globalTime/1000 << " " << totCorrect * 1.0 / (numBatchesTest*Batchsize) << endl;
+}
 
+/**
+ * \brief whether a file derived from `source` is missing or older than it
+ */
+bool IsStale(const string& derived, const string& source) {
+  struct stat source_stat, derived_stat;
+  return stat(derived.c_str(), &derived_stat) != 0 ||
+         (stat(source.c_str(), &source_stat) == 0 &&
+          source_stat.st_mtime > derived_stat.st_mtime);
 }
 
-void ReadDataSVM(int numBatches,  Network* _mynet, int epoch){
-  std::ifstream file(trainData);
-  float accumlogss = 0;
-  std::string str;
-  //skipe header
-  if (has_header)
-    std::getline( file, str );
-  int totalTime = 0;
-  ProgressBar progress_bar(numBatches, "Training epoch " + to_string(epoch));
-  for (size_t i = 0; i < numBatches; i++, ++progress_bar) {
+/**
+ * \brief open the binary CSR cache "<file>.csr", converting the text file
+ *        first when the cache is missing or older than the text file
+ */
+MappedCSR* OpenCSRCache(const string& svm_file) {
+  string csr_file = svm_file + ".csr";
+  if (IsStale(csr_file, svm_file)) {
+    convert_svm_to_csr(svm_file, csr_file, has_header);
+  }
+  return new MappedCSR(csr_file);
+}
 
-    int **records = new int *[Batchsize];
-    float **values = new float *[Batchsize];
-    int *sizes = new int[Batchsize];
-    int **labels = new int *[Batchsize];
-    int *labelsize = new int[Batchsize];
-    int nonzeros = 0;
-    int count = 0;
-    vector<string> list;
-    vector<string> value;
-    vector<string> label;
-    while (std::getline(file, str)) {
-      char *mystring = &str[0];
-      char *pch, *pchlabel;
-      int track = 0;
-      list.clear();
-      value.clear();
-      label.clear();
-      pch = strtok(mystring, " ");
-      pch = strtok(NULL, " :");
-      while (pch != NULL) {
-        if (track % 2 == 0)
-          list.push_back(pch);
-        else if (track%2==1)
-          value.push_back(pch);
-        track++;
-        pch = strtok(NULL, " :");
-      }
+/**
+ * \brief the compressed copy "<file>.vqz", converted first when it is
+ *        missing, older than the text file, of an older format or its
+ *        values are not encoded as HalfValues asks
+ */
+string OpenCompressed(const string& svm_file) {
+  string compressed_file = svm_file + ".vqz";
+  if (IsStale(compressed_file, svm_file) ||
+      !is_compressed(compressed_file) ||
+      CompressedReader(compressed_file).header().half_values != HalfValues) {
+    convert_svm_to_compressed(svm_file, compressed_file, has_header,
+                              HalfValues);
+  }
+  return compressed_file;
+}
 
-      pchlabel = strtok(mystring, ",");
-      while (pchlabel != NULL) {
-        label.push_back(pchlabel);
-        pchlabel = strtok(NULL, ",");
-      }
+/**
+ * \brief load the feature map "<trainData>.fmap", or count the feature
+ *        frequencies of the train split (in memory if given, otherwise
+ *        from the text) and save a new one
+ */
+FeatureMap* OpenFeatureMap(const CSRView* train) {
+  string map_file = trainData + ".fmap";
+  FeatureMap* featureMap = new FeatureMap(InputDim);
+  if (IsStale(map_file, trainData) ||
+      !featureMap->load(map_file, MinFeatureCount)) {
+    if (train)
+      featureMap->count(*train);
+    else
+      featureMap->count(trainData, has_header);
+    featureMap->build(MinFeatureCount);
+    featureMap->save(map_file);
+  }
+  std::cout << "keeping " << featureMap->size() << " of " << InputDim
+            << " features seen at least " << MinFeatureCount << " times"
+            << std::endl;
+  return featureMap;
+}
 
-      nonzeros += list.size();
-      records[count] = new int[list.size()];
-      values[count] = new float[list.size()];
-      labels[count] = new int[label.size()];
-      sizes[count] = list.size();
-      labelsize[count] = label.size();
-      int currcount = 0;
-      vector<string>::iterator it;
-      for (it = list.begin(); it < list.end(); it++) {
-        records[count][currcount] = stoi(*it);
-        currcount++;
-      }
-      currcount = 0;
-      for (it = value.begin(); it < value.end(); it++) {
-        values[count][currcount] = stof(*it);
-        currcount++;
-      }
+/**
+ * \brief evaluate on the test split packed once in memory, the batch
+ *        covers the whole split and every slice of batches is predicted
+ *        in one parallel loop. Unless `full`, only the first EvalSamples
+ *        records are scored and scoring stops once EvalBudget
+ *        milliseconds are spent; the batch is then in a fixed random
+ *        order, so every prefix is a uniform sample of the split and the
+ *        accuracy is reported with a 95% confidence interval.
+ */
+void EvalDataCSR(int numBatchesTest, Network* _mynet, int iter,
+                 const SparseBatch& test, bool full) {
+  const int SLICE = 16;  // batches per parallel predict
+  int limit = numBatchesTest;
+  if (!full && EvalSamples > 0)
+    limit = std::min(limit, (EvalSamples + Batchsize - 1) / Batchsize);
 
-      currcount = 0;
-      for (it = label.begin(); it < label.end(); it++) {
-        int l = stoi(*it);
-        labels[count][currcount] = l > 0 ?  l : 0;
-        currcount++;
-      }
+  int totCorrect = 0;
+  int totScored = 0;
+  auto t1 = std::chrono::high_resolution_clock::now();
+  ProgressBar progress_bar(limit, full ? "Testing" : "Testing (sampled)");
+  ofstream outputFile(logFile,  std::ios_base::app);
+  for (int i = 0; i < limit; i += SLICE) {
+    int batches = std::min(SLICE, limit - i);
+    size_t begin = (size_t)i * Batchsize;
+    totCorrect += _mynet->predict(test.slice(begin, batches * Batchsize));
+    totScored += batches * Batchsize;
+    progress_bar += batches;
 
-      count++;
-      if (count >= Batchsize)
-        break;
+    auto t2 = std::chrono::high_resolution_clock::now();
+    if (!full && EvalBudget > 0 &&
+        std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count() > EvalBudget) {
+      cout << endl;
+      break;
     }
+  }
 
+  // normal approximation with finite population correction,
+  // it vanishes once the whole split is scored
+  const int population = numBatchesTest * Batchsize;
+  double accuracy = totCorrect * 1.0 / totScored;
+  double fpc = population > 1 ? (population - totScored) * 1.0 / (population - 1) : 0;
+  double interval = 1.96 * std::sqrt(accuracy * (1 - accuracy) / totScored * fpc);
+  cout << "over all " << accuracy << " +- " << interval
+       << " (" << totScored << " records)" << endl;
+  outputFile << iter << " " << globalTime/1000 << " " << accuracy << " " << interval << endl;
+}
 
+/**
+ * \brief score the whole test split with the int8 inference copies of the
+ *        trained network, against the fp32 path
+ */
+void EvalInt8(Network* _mynet, const SparseBatch& test) {
+  _mynet->quantize();
+  const int records = test.rows;
 
-    auto t1 = std::chrono::high_resolution_clock::now();
-
+  auto t1 = std::chrono::high_resolution_clock::now();
+  const int correct = _mynet->predict(test);
+  auto t2 = std::chrono::high_resolution_clock::now();
+  const int correct_int8 = _mynet->predict(test, /*quantized*/true);
+  auto t3 = std::chrono::high_resolution_clock::now();
+  const int agree = _mynet->agreement(test);
+
+  auto ms = [](std::chrono::high_resolution_clock::duration d) {
+    return std::chrono::duration_cast<std::chrono::milliseconds>(d).count();
+  };
+  cout << "int8 over all " << correct_int8 * 1.0 / records
+       << " (fp32 " << correct * 1.0 / records << "), top-1 agreement "
+       << agree * 1.0 / records << ", " << ms(t3 - t2) << " ms (fp32 "
+       << ms(t2 - t1) << " ms)" << endl;
+  ofstream outputFile(logFile,  std::ios_base::app);
+  outputFile << "int8 " << correct_int8 * 1.0 / records << " agreement "
+             << agree * 1.0 / records << endl;
+}
 
-    auto loss = _mynet->train(records, values, sizes, labels, labelsize);
+/**
+ * \brief train one epoch over a CSR dataset, the records are copied and
+ *        remapped batch by batch when a feature map is given
+ */
+void ReadDataCSR(int numBatches, Network* _mynet, int epoch,
+                 const CSRDataset& data, const FeatureMap* featureMap) {
+  CSRBatch remapped;
+  ProgressBar progress_bar(numBatches, "Training epoch " + to_string(epoch));
+  for (size_t i = 0; i < numBatches; i++, ++progress_bar) {
+    SparseBatch batch;
+    if (featureMap) {
+      data.batch(i, Batchsize, remapped);
+      featureMap->apply(remapped);
+      batch = remapped.view();
+    } else {
+      batch = data.batch(i, Batchsize);
+    }
 
+    auto t1 = std::chrono::high_resolution_clock::now();
+    _mynet->train(batch);
     auto t2 = std::chrono::high_resolution_clock::now();
 
     int timeDiffInMiliseconds = std::chrono::duration_cast<std::chrono::milliseconds>(t2 - t1).count();
     globalTime+= timeDiffInMiliseconds;
-
-    delete[] sizes;
-
-    for (size_t d = 0; d < Batchsize; d++) {
-      delete[] records[d];
-      delete[] values[d];
-      delete[] labels[d];
-    }
-    delete[] records;
-    delete[] values;
-    delete[] labels;
-
   }
-  file.close();
-
 }
 
 
@@ -455,11 +506,96 @@ int main(int argc, char* argv[])
   int numBatches = totRecords/Batchsize;
   int numBatchesTest = totRecordsTest/Batchsize;
 
+  MappedCSR* trainCSR = nullptr;
+  MappedCSR* testCSR = nullptr;
+  CSRBatch trainMemory, testMemory;
+  string trainSource = trainData;
+  if (BinaryCache) {
+    trainCSR = OpenCSRCache(trainData);
+    testCSR = OpenCSRCache(testData);
+  } else if (Compressed) {
+    // decoded block by block, much less to read than the text
+    trainSource = OpenCompressed(trainData);
+    load_compressed(OpenCompressed(testData), testMemory);
+  } else {
+    // the test split is parsed once and reused by every evaluation
+    load_svm(testData, has_header, testMemory);
+  }
+  if (InMemory) {
+    // hold the whole train split and walk it in a new order every epoch
+    if (trainCSR) {
+      trainMemory.clear();
+      trainMemory.append(trainCSR->view(), 0, trainCSR->num_rows());
+    } else if (Compressed) {
+      load_compressed(trainSource, trainMemory);
+    } else {
+      load_svm(trainData, has_header, trainMemory);
+    }
+  }
+
+  FeatureMap* featureMap = nullptr;
+  if (MinFeatureCount > 0) {
+    // prune rare features and shrink the input layer to the survivors
+    CSRView trainView;
+    if (InMemory)
+      trainView = trainMemory.view();
+    else if (trainCSR)
+      trainView = trainCSR->view();
+    featureMap = OpenFeatureMap((InMemory || trainCSR) ? &trainView : nullptr);
+    InputDim = featureMap->size();
+    if (InMemory)
+      featureMap->apply(trainMemory);
+    if (testCSR) {
+      testMemory.clear();
+      testMemory.append(testCSR->view(), 0, testCSR->num_rows());
+    }
+    featureMap->apply(testMemory);
+  }
+
+  CSRDataset* trainSet = nullptr;
+  if (InMemory)
+    trainSet = new CSRDataset(trainMemory.view());
+  else if (trainCSR)
+    trainSet = new CSRDataset(trainCSR->view());
+  CSRDataset* testSet = new CSRDataset(
+    (testCSR && !featureMap) ? testCSR->view() : testMemory.view());
+
+  if (trainSet)
+    numBatches = std::min(numBatches, trainSet->num_rows() / Batchsize);
+  numBatchesTest = std::min(numBatchesTest, testSet->num_rows() / Batchsize);
+  if (EvalSamples > 0 || EvalBudget > 0)
+    testSet->shuffle();  // fixed seed, the same sample in every evaluation
+  const SparseBatch testBatch = testSet->batch(0, numBatchesTest * Batchsize);
+
 
 
   auto t1 = std::chrono::high_resolution_clock::now();
-  Optimizer optimizer = {Lr}; // TODO modify config file later
-  Network *_mynet = new Network(sizesOfLayers, numLayer, Batchsize, optimizer, InputDim);
+  Optimizer optimizer = {Lr, Minibatch}; // TODO modify config file later
+  if (Method == "Adagrad")
+    optimizer.method = Adagrad;
+  else if (Method == "Adam")
+    optimizer.method = Adam;
+  else if (Method != "SGD")
+    throw std::runtime_error("unknown optimizer " + Method);
+  Precision precision = FP32;
+  if (Storage == "fp16")
+    precision = FP16;
+  else if (Storage == "bf16")
+    precision = BF16;
+  else if (Storage != "fp32")
+    throw std::runtime_error("unknown precision " + Storage);
+  if (TopKSize < 0)
+    throw std::runtime_error("TopK must not be negative, got " +
+                             std::to_string(TopKSize));
+  if (!(TopMass > 0 && TopMass <= 1))
+    throw std::runtime_error("TopMass must be in (0, 1], got " +
+                             std::to_string(TopMass));
+  Network *_mynet = new Network(sizesOfLayers, numLayer, Batchsize, optimizer,
+                                InputDim, precision, FastScan);
+  TopK top_k;
+  top_k.k = TopKSize;
+  top_k.mass = TopMass;
+  _mynet->top_k(top_k);
   auto t2 = std::chrono::high_resolution_clock::now();
   float timeDiffInMiliseconds = std::chrono::duration_cast<std::chrono::microseconds>(t2 - t1).count();
   std::cout << "Network Initialization takes " << timeDiffInMiliseconds/1000 << " milliseconds" << std::endl;
@@ -469,22 +605,42 @@ int main(int argc, char* argv[])
   //***********************************
 
   const int schedule_epoch = Epoch / 5;
-  EvalDataSVM(numBatchesTest, _mynet, 0);
+  EvalDataCSR(numBatchesTest, _mynet, 0, testBatch, Epoch == 0);
   for (int e=0; e< Epoch; e++) {
     ofstream outputFile(logFile,  std::ios_base::app);
     outputFile<<"Epoch "<<e<<endl;
-    if (e > 0 && (e % schedule_epoch == 0)) {
+    // the adaptive methods scale their own steps
+    if (optimizer.method == SGD && e > 0 && (e % schedule_epoch == 0)) {
       optimizer.lr /= 3.0;
       std::cout << "Epoch: " << e << " lr: " << optimizer.lr << "\n";
     }
     // train
-    ReadDataSVM(numBatches, _mynet, e);
+    if (InMemory)
+      trainSet->shuffle();
+    if (trainSet)
+      ReadDataCSR(numBatches, _mynet, e, *trainSet,
+                  InMemory ? nullptr : featureMap);
+    else
+      ReadDataSVM(numBatches, _mynet, e, trainSource, featureMap);
+    if (!optimizer.accumulate) {
+      HogwildStats stats = hogwild_stats(/*reset*/true);
+      outputFile << "hogwild row updates " << stats.updates
+                 << " conflicts " << stats.conflicts << endl;
+    }
     // test
-    EvalDataSVM(numBatchesTest, _mynet, (e+1)*numBatches);
+    EvalDataCSR(numBatchesTest, _mynet, (e+1)*numBatches, testBatch,
+                e == Epoch - 1);
     _mynet->save_weight(savedWeights);
 
   }
-
+  if (Int8)
+    EvalInt8(_mynet, testBatch);
+
+  delete trainSet;
+  delete testSet;
+  delete trainCSR;
+  delete testCSR;
+  delete featureMap;
   delete [] RangePow;
   delete [] K;
   delete [] L;
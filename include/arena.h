@@ -0,0 +1,147 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <algorithm>
+#include <cstddef>
+#include <memory>
+#include <type_traits>
+#include <vector>
+
+/**
+ * \brief per-thread bump allocator, memory is only released by rewinding
+ *        to a mark and the blocks are kept, so once warmed up the hot
+ *        path performs no malloc/free
+ */
+class Arena {
+ public:
+  struct Mark {
+    size_t block;
+    size_t offset;
+  };
+
+  /**
+   * \return arena of the calling thread
+   */
+  static Arena& local() {
+    static thread_local Arena arena;
+    return arena;
+  }
+  /**
+   * \return arena the ArenaAllocators of this thread draw from,
+   *         nullptr outside of any ArenaScope
+   */
+  static Arena*& active() {
+    static thread_local Arena* arena = nullptr;
+    return arena;
+  }
+
+  void* allocate(size_t bytes, size_t align) {
+    size_t begin = (offset_ + align - 1) & ~(align - 1);
+    for (; block_ < blocks_.size(); ++block_, begin = 0) {
+      if (begin + bytes <= sizes_[block_]) {
+        offset_ = begin + bytes;
+        return blocks_[block_].get() + begin;
+      }
+    }
+    const size_t size = std::max(BLOCK_SIZE, bytes);
+    blocks_.emplace_back(new char[size]);
+    sizes_.push_back(size);
+    block_ = blocks_.size() - 1;
+    offset_ = bytes;
+    return blocks_[block_].get();
+  }
+
+  Mark mark() const {
+    return {block_, offset_};
+  }
+  void rewind(const Mark& mark) {
+    block_ = mark.block;
+    offset_ = mark.offset;
+  }
+  size_t capacity() const {
+    size_t capacity = 0;
+    for (size_t size : sizes_)
+      capacity += size;
+    return capacity;
+  }
+
+ private:
+  static constexpr size_t BLOCK_SIZE = 1 << 20;
+
+  std::vector<std::unique_ptr<char[]> >  blocks_;
+  std::vector<size_t >                    sizes_;
+  size_t                                  block_ = 0;
+  size_t                                  offset_ = 0;
+};
+
+/**
+ * \brief makes the thread arena active while alive and releases
+ *        everything allocated from it in the meantime on destruction,
+ *        so any container using it must not outlive the scope
+ */
+class ArenaScope {
+ public:
+  ArenaScope()
+    : arena_(Arena::local()), previous_(Arena::active()),
+      mark_(arena_.mark()) {
+    Arena::active() = &arena_;
+  }
+  ~ArenaScope() {
+    arena_.rewind(mark_);
+    Arena::active() = previous_;
+  }
+
+  ArenaScope(const ArenaScope&) = delete;
+  ArenaScope& operator=(const ArenaScope&) = delete;
+
+ private:
+  Arena&       arena_;
+  Arena*       previous_;
+  Arena::Mark  mark_;
+};
+
+/**
+ * \brief std allocator drawing from the arena active at construction,
+ *        or from the heap outside of any ArenaScope. Copies of a
+ *        container draw from the arena active when they are made.
+ */
+template <typename U>
+class ArenaAllocator {
+ public:
+  using value_type = U;
+  using propagate_on_container_move_assignment = std::true_type;
+  using propagate_on_container_swap = std::true_type;
+
+  ArenaAllocator() noexcept : arena_(Arena::active()) {}
+  template <typename V>
+  ArenaAllocator(const ArenaAllocator<V>& a) noexcept : arena_(a.arena_) {}
+
+  U* allocate(size_t n) {
+    if (arena_)
+      return static_cast<U*>(arena_->allocate(n * sizeof(U), alignof(U)));
+    return std::allocator<U>().allocate(n);
+  }
+  void deallocate(U* p, size_t n) {
+    if (!arena_)
+      std::allocator<U>().deallocate(p, n);
+  }
+  ArenaAllocator select_on_container_copy_construction() const {
+    return ArenaAllocator();
+  }
+
+  template <typename V>
+  bool operator==(const ArenaAllocator<V>& a) const {
+    return arena_ == a.arena_;
+  }
+  template <typename V>
+  bool operator!=(const ArenaAllocator<V>& a) const {
+    return arena_ != a.arena_;
+  }
+
+  Arena* arena_;
+};
+
+template <typename U>
+using ArenaVector = std::vector<U, ArenaAllocator<U> >;
@@ -0,0 +1,31 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include "tensor.h"
+
+/**
+ * \brief where the code of output o in subspace m is stored in the codes
+ *        of n outputs. With Block = 0 the codes are [n, M], the codes of
+ *        an output are contiguous. Otherwise the outputs are grouped in
+ *        blocks of Block, stored [n / Block, M, Block] and padded to a
+ *        whole block: the codes of a block in one subspace are contiguous
+ *        and are scored together with gathers from one table
+ */
+template <size_type M, size_type Block>
+struct CodeLayout {
+  // distance between the codes of an output in consecutive subspaces
+  static constexpr size_type stride = Block > 0 ? Block : 1;
+
+  static size_type size(size_type n) {
+    if constexpr (Block > 0)
+      return (n + Block - 1) / Block * Block * M;
+    return n * M;
+  }
+  static size_type slot(size_type o, size_type m) {
+    if constexpr (Block > 0)
+      return (o / Block * M + m) * Block + o % Block;
+    return o * M + m;
+  }
+};
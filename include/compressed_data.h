@@ -0,0 +1,108 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "csr_data.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * \brief header of the compressed sparse dataset format. The records are
+ *        stored in independent blocks of `block_rows` rows followed by an
+ *        index of block offsets [num_blocks + 1]. Within a block every
+ *        row is "varint nnz | varint #labels | varint labels | zigzag
+ *        varint index deltas" and the values of the block follow the
+ *        rows as fp16, fp32, or nothing at all when they are all ones.
+ */
+struct CompressedHeader {
+  uint64_t magic;
+  uint64_t num_rows;
+  uint64_t nnz;
+  uint64_t num_entries;
+  uint64_t num_blocks;
+  uint64_t block_rows;
+  uint64_t index_offset;   // byte offset of the block index
+  uint64_t num_features;
+  uint64_t num_labels;
+  uint64_t half_values;    // values were written as fp16
+};
+
+const uint64_t COMPRESSED_MAGIC = 0x32305a5143515600ULL;  // "\0VQCQZ02"
+
+enum ValueCoding : uint8_t {
+  ValueOnes = 0, ValueHalf = 1, ValueFloat = 2
+};
+
+/**
+ * \return whether the file starts with the compressed format magic
+ */
+bool is_compressed(const string& file);
+
+/**
+ * \brief encode rows [begin, end) of a view as one block
+ * \param half_values store values as fp16 instead of fp32
+ */
+void encode_block(const CSRView& data, size_type begin, size_type end,
+                  bool half_values, vector<uint8_t >& block);
+
+/**
+ * \brief decode one block, appending its rows to the batch
+ * \return number of bytes consumed
+ */
+size_t decode_block(const uint8_t* block, CSRBatch& batch);
+
+/**
+ * \brief convert a libsvm/XML text file into the compressed format
+ */
+void convert_svm_to_compressed(const string& svm_file,
+                               const string& compressed_file,
+                               bool has_header, bool half_values,
+                               size_type block_rows = 1 << 14);
+
+/**
+ * \brief block-wise decoder over a read only mmap of a compressed file
+ */
+class CompressedReader {
+ public:
+  explicit CompressedReader(const string& compressed_file);
+  ~CompressedReader();
+
+  CompressedReader(const CompressedReader&) = delete;
+  CompressedReader& operator=(const CompressedReader&) = delete;
+
+  const CompressedHeader& header() const {
+    return *header_;
+  }
+  /**
+   * \brief decode the next block, appending its rows to the batch
+   * \return number of rows appended, 0 at the end of file
+   */
+  int read(CSRBatch& batch);
+  /**
+   * \brief decode the next blocks, one per thread, in parallel
+   * \param chunks per thread scratch batches, reused across calls
+   * \param threads blocks decoded at once, the loader thread passes a
+   *                small count so it does not compete with training
+   * \return number of rows appended, 0 at the end of file
+   */
+  int read_parallel(CSRBatch& batch, vector<CSRBatch >& chunks,
+                    int threads = omp_get_max_threads());
+
+ private:
+  void*                    addr_;
+  size_t                   length_;
+  const CompressedHeader*  header_;
+  const uint64_t*          block_offset_;  // shape of [num_blocks + 1]
+  uint64_t                 next_block_;
+};
+
+/**
+ * \brief decode a whole compressed split into memory
+ */
+void load_compressed(const string& compressed_file, CSRBatch& data);
@@ -0,0 +1,198 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <algorithm>
+#include <cstdint>
+#include <numeric>
+#include <random>
+#include <string>
+#include <vector>
+#include "tensor.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * \brief header of the binary CSR cache of a libsvm/XML dataset
+ *        (see data/README.md for the text format). The file layout is
+ *        header | row offsets [n+1] | label offsets [n+1]
+ *               | indices [nnz] | values [nnz] | labels [nl]
+ *        so that every section is naturally aligned.
+ */
+struct CSRHeader {
+  uint64_t magic;
+  uint64_t num_rows;      // number of records
+  uint64_t nnz;           // number of (feature, value) pairs
+  uint64_t num_entries;   // number of labels over all records
+  uint64_t num_features;  // as declared in the text header, 0 if absent
+  uint64_t num_labels;    // as declared in the text header, 0 if absent
+};
+
+const uint64_t CSR_MAGIC = 0x3130525343515600ULL;  // "\0VQCSR01"
+
+/**
+ * \brief the CSR readers hand out batches in file order, see SparseBatch
+ */
+using CSRView = SparseBatch;
+
+/**
+ * \brief one parsed batch in CSR form, buffers are reused across batches
+ */
+struct CSRBatch {
+  vector<uint64_t >  offset_;
+  vector<uint64_t >  label_offset_;
+  vector<size_type > index_;
+  vector<T >         value_;
+  vector<size_type > label_;
+
+  void clear() {
+    offset_.assign(1, 0);
+    label_offset_.assign(1, 0);
+    index_.clear();
+    value_.clear();
+    label_.clear();
+  }
+  size_type rows() const {
+    return static_cast<size_type>(offset_.size()) - 1;
+  }
+  CSRView view() const {
+    return {rows(), offset_.data(), label_offset_.data(),
+            index_.data(), value_.data(), label_.data()};
+  }
+  /**
+   * \brief append a copy of rows [begin, end) of a view
+   */
+  void append(const CSRView& v, size_type begin, size_type end) {
+    const uint64_t nnz = index_.size() - v.offset[begin];
+    const uint64_t entries = label_.size() - v.label_offset[begin];
+    for (size_type r = begin + 1; r <= end; ++r) {
+      offset_.push_back(nnz + v.offset[r]);
+      label_offset_.push_back(entries + v.label_offset[r]);
+    }
+    index_.insert(index_.end(), v.index + v.offset[begin],
+                  v.index + v.offset[end]);
+    value_.insert(value_.end(), v.value + v.offset[begin],
+                  v.value + v.offset[end]);
+    label_.insert(label_.end(), v.label + v.label_offset[begin],
+                  v.label + v.label_offset[end]);
+  }
+};
+
+/**
+ * \brief append the chunks to the batch in order, copying in parallel
+ *        with one thread per chunk
+ * \return number of rows appended
+ */
+int stitch(const vector<CSRBatch >& chunks, CSRBatch& batch);
+
+/**
+ * \brief iterates over an in-memory (or mapped) CSR dataset in file
+ *        order, or in a fresh random permutation after each shuffle(),
+ *        batches only point into the dataset and never copy records
+ */
+class CSRDataset {
+ public:
+  explicit CSRDataset(const CSRView& data, unsigned seed = 1016)
+    : data_(data), generator_(seed) {}
+
+  /**
+   * \brief draw a new random order of the rows for the next epoch
+   */
+  void shuffle() {
+    if (order_.empty()) {
+      order_.resize(data_.rows);
+      std::iota(order_.begin(), order_.end(), 0);
+    }
+    std::shuffle(order_.begin(), order_.end(), generator_);
+  }
+  size_type num_rows() const {
+    return data_.rows;
+  }
+  /**
+   * \brief view over the b-th batch of the current order
+   */
+  SparseBatch batch(size_type b, size_type batch_size) const {
+    SparseBatch all = data_;
+    if (!order_.empty())
+      all.order = order_.data();
+    return all.slice(b * batch_size, batch_size);
+  }
+  /**
+   * \brief copy the b-th batch of the current order, for callers that
+   *        rewrite the records
+   * \return number of rows in the batch
+   */
+  size_type batch(size_type b, size_type batch_size, CSRBatch& copy) const {
+    size_type begin = b * batch_size;
+    size_type rows = std::max(0, std::min(batch_size, data_.rows - begin));
+    copy.clear();
+    if (order_.empty()) {
+      copy.append(data_, begin, begin + rows);
+    } else {
+      for (size_type r = begin; r < begin + rows; ++r) {
+        copy.append(data_, order_[r], order_[r] + 1);
+      }
+    }
+    return rows;
+  }
+
+ private:
+  CSRView                 data_;
+  vector<size_type >      order_;
+  std::default_random_engine generator_;
+};
+
+/**
+ * \brief parse a whole text split into memory with all OpenMP threads
+ */
+void load_svm(const string& svm_file, bool has_header, CSRBatch& data);
+
+/**
+ * \brief one pass conversion of a libsvm/XML text file into a binary CSR
+ *        cache file, labels are clamped to be non-negative as in training
+ * \param svm_file   text dataset
+ * \param csr_file   output binary file
+ * \param has_header whether the first line is "Total Features Labels"
+ */
+void convert_svm_to_csr(const string& svm_file, const string& csr_file,
+                        bool has_header);
+
+/**
+ * \brief read only mmap of a binary CSR cache, batches are zero-copy views
+ */
+class MappedCSR {
+ public:
+  explicit MappedCSR(const string& csr_file);
+  ~MappedCSR();
+
+  MappedCSR(const MappedCSR&) = delete;
+  MappedCSR& operator=(const MappedCSR&) = delete;
+
+  size_type num_rows() const {
+    return static_cast<size_type>(header_->num_rows);
+  }
+  const CSRHeader& header() const {
+    return *header_;
+  }
+  /**
+   * \brief view over rows [begin, begin + size), clipped to num_rows()
+   */
+  CSRView batch(size_type begin, size_type size) const {
+    return view().slice(begin, size);
+  }
+  CSRView view() const {
+    return {num_rows(), offset_, label_offset_, index_, value_, label_};
+  }
+
+ private:
+  void*              addr_;
+  size_t             length_;
+  const CSRHeader*   header_;
+  const uint64_t*    offset_;
+  const uint64_t*    label_offset_;
+  const size_type*   index_;
+  const T*           value_;
+  const size_type*   label_;
+};
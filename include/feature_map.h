@@ -0,0 +1,75 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <cstdint>
+#include <string>
+#include <vector>
+#include "csr_data.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * \brief maps the raw feature ids of a huge input space to a dense id
+ *        space, features seen less than `min_count` times in training
+ *        are dropped and the survivors are ordered by decreasing
+ *        frequency, so hot features cluster at low ids
+ */
+class FeatureMap {
+ public:
+  explicit FeatureMap(size_type num_features)
+    : num_features_(num_features), min_count_(0), size_(0) {}
+
+  /**
+   * \brief accumulate feature frequencies over a dataset
+   */
+  void count(const CSRView& data);
+  void count(const string& svm_file, bool has_header);
+
+  /**
+   * \brief build the mapping from the accumulated frequencies
+   */
+  void build(int min_count);
+
+  /**
+   * \brief load a mapping saved with the same min_count and input size
+   * \return false if the file is missing or was built differently
+   */
+  bool load(const string& file, int min_count);
+  void save(const string& file) const;
+
+  /**
+   * \return dense id of a raw feature id, -1 if the feature is dropped
+   */
+  size_type operator[](size_type id) const {
+    return (id >= 0 && id < num_features_) ? map_[id] : -1;
+  }
+  /**
+   * \return raw feature id of every dense id
+   */
+  const vector<size_type >& features() const {
+    return features_;
+  }
+  size_type size() const {
+    return size_;
+  }
+
+  /**
+   * \brief rewrite the feature ids of every row in place, dropping the
+   *        pruned features and keeping each row sorted by dense id
+   * \param threads team size, the loader thread passes a small one so
+   *                it does not compete with training for the cores
+   */
+  void apply(CSRBatch& data, int threads = omp_get_max_threads()) const;
+
+ private:
+  size_type            num_features_;  // size of the raw id space
+  int                  min_count_;
+  size_type            size_;          // size of the dense id space
+  vector<uint32_t >    counts_;        // shape of [num_features_]
+  vector<size_type >   map_;           // raw id -> dense id or -1
+  vector<size_type >   features_;      // dense id -> raw id
+};
@@ -0,0 +1,187 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <algorithm>
+#include <cstring>
+#include <memory>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+#include "optimizer.h"
+#include "precision.h"
+#include "tensor.h"
+
+using std::vector;
+
+/**
+ * \brief per-thread sparse accumulation of the gradient of a parameter of
+ *        shape [rows, width] during a minibatch. Threads add their
+ *        gradients to row(r), which lives in a block of the thread only
+ *        once the row is touched, and apply() sums the rows of the
+ *        threads in thread order, so the result does not depend on the
+ *        scheduling, and steps the optimizer once per touched row.
+ */
+class GradientAccumulator {
+ public:
+  GradientAccumulator(size_type rows, size_type width)
+    : width_(width),
+      block_rows_(std::max<size_type>(
+        1, std::min<size_type>(rows, BLOCK_SIZE / std::max(width, 1)))),
+      local_(omp_get_max_threads()) {}
+
+  /**
+   * \return the gradient row r of the calling thread, zero until applied,
+   *         it stays in place until apply()
+   */
+  T* row(size_type r) {
+    Local& local = local_at(omp_get_thread_num());
+    return delta(local, slot(local, r));
+  }
+
+  /**
+   * \brief step(r, grad) once for every touched row r, grad being the
+   *        gradient of the row summed over the threads, then reset the
+   *        gradients; the rows are stepped in parallel
+   */
+  template <typename F>
+  void apply(F&& step) {
+    // fold the rows of the other threads into those of the first one
+    Local& first = local_[0];
+    for (size_t t = 1; t < local_.size(); ++t) {
+      Local& local = local_[t];
+      const size_type n = local.touched.size();
+      slots_.resize(n);
+      for (size_type s = 0; s < n; ++s)
+        slots_[s] = slot(first, local.touched[s]);
+#pragma omp parallel for schedule(static) if (n * width_ > BLOCK_SIZE)
+      for (size_type s = 0; s < n; ++s) {
+        T* d = delta(local, s);
+        T* sum = delta(first, slots_[s]);
+        for (size_type k = 0; k < width_; ++k) {
+          sum[k] += d[k];
+        }
+        std::memset(d, 0, width_ * sizeof(T));
+      }
+      reset(local);
+    }
+    const size_type n = first.touched.size();
+#pragma omp parallel for schedule(static) if (n * width_ > BLOCK_SIZE)
+    for (size_type s = 0; s < n; ++s) {
+      T* d = delta(first, s);
+      step(first.touched[s], static_cast<const T*>(d));
+      std::memset(d, 0, width_ * sizeof(T));
+    }
+    reset(first);
+  }
+
+  /**
+   * \brief param[r] takes a step of the optimizer for every touched row
+   *        r, the state of the row being row r of state
+   */
+  template <typename W>
+  void apply(W* param, const Optimizer& optimizer, OptimizerState& state) {
+    apply([&](size_type r, const T* grad) {
+      W* p = param + static_cast<size_t>(r) * width_;
+      const StateRow row = state.touch(optimizer, r);
+      for (size_type k = 0; k < width_; ++k) {
+        add_rounded(p[k], state.delta(optimizer, row, k, grad[k]));
+      }
+    });
+  }
+
+ private:
+  static const size_type BLOCK_SIZE = 1 << 12;  // values per block at most
+
+  struct Local {
+    vector<size_type >             touched;  // rows in touch order
+    // open addressing row -> touch order, at most half full
+    vector<std::pair<size_type, size_type> >  table;
+    vector<std::unique_ptr<T[]> >  blocks;   // [block_rows_, width_] each
+  };
+  /**
+   * \return the touch order of row r in local, touching it if needed
+   */
+  size_type slot(Local& local, size_type r) {
+    size_type& order = find(local, r);
+    if (order < 0) {
+      order = local.touched.size();
+      if (local.touched.size() == local.blocks.size() * block_rows_)
+        local.blocks.emplace_back(
+          new T[static_cast<size_t>(block_rows_) * width_]());
+      local.touched.push_back(r);
+    }
+    return order;
+  }
+  void reset(Local& local) {
+    if (!local.touched.empty())
+      std::fill(local.table.begin(), local.table.end(),
+                std::pair<size_type, size_type>(-1, -1));
+    local.touched.clear();
+  }
+  Local& local_at(int thread) {
+    if (thread >= local_.size())
+      throw std::runtime_error("more threads than when the layer was built");
+    return local_[thread];
+  }
+  /**
+   * \return the touch order of row r, -1 to be set if r is untouched
+   */
+  size_type& find(Local& local, size_type r) {
+    if (2 * (local.touched.size() + 1) > local.table.size()) {
+      local.table.assign(std::max<size_t>(64, 2 * local.table.size()),
+                         {-1, -1});
+      for (size_type s = 0; s < local.touched.size(); ++s)
+        probe(local, local.touched[s]) = {local.touched[s], s};
+    }
+    auto& entry = probe(local, r);
+    entry.first = r;
+    return entry.second;
+  }
+  std::pair<size_type, size_type>& probe(Local& local, size_type r) {
+    const size_t mask = local.table.size() - 1;
+    size_t h = (static_cast<uint32_t>(r) * 2654435761u) & mask;
+    while (local.table[h].first >= 0 && local.table[h].first != r)
+      h = (h + 1) & mask;
+    return local.table[h];
+  }
+  T* delta(Local& local, size_type s) const {
+    return &local.blocks[s / block_rows_][
+      static_cast<size_t>(s % block_rows_) * width_];
+  }
+
+  const size_type      width_;
+  const size_type      block_rows_;
+  vector<Local >       local_;
+  vector<size_type >   slots_;  // rows of the first thread, in apply()
+};
+
+/**
+ * \brief per-thread list of assignments to a parameter made during a
+ *        minibatch, replayed thread after thread by apply()
+ */
+template <typename V>
+class DeferredWrites {
+ public:
+  DeferredWrites() : local_(omp_get_max_threads()) {}
+
+  void push(size_type index, V value) {
+    const int thread = omp_get_thread_num();
+    if (thread >= local_.size())
+      throw std::runtime_error("more threads than when the layer was built");
+    local_[thread].emplace_back(index, value);
+  }
+  void apply(V* param) {
+    for (auto& writes : local_) {
+      for (auto& write : writes) {
+        param[write.first] = write.second;
+      }
+      writes.clear();
+    }
+  }
+
+ private:
+  vector<vector<std::pair<size_type, V> > > local_;
+};
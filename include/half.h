@@ -0,0 +1,64 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <cstdint>
+#include <cstring>
+
+/**
+ * \brief IEEE 754 binary16 <-> binary32 conversion, rounding to nearest even
+ */
+inline uint16_t float_to_half(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  const uint32_t sign = (x >> 16) & 0x8000u;
+  const uint32_t abs = x & 0x7fffffffu;
+
+  if (abs >= 0x7f800000u)  // inf or nan, keep nan quiet
+    return static_cast<uint16_t>(sign | 0x7c00u |
+                                 (abs > 0x7f800000u ? 0x200u : 0));
+  if (abs >= 0x477ff000u)  // rounds above the largest half
+    return static_cast<uint16_t>(sign | 0x7c00u);
+  if (abs < 0x38800000u) {  // subnormal half or zero
+    if (abs < 0x33000000u)
+      return static_cast<uint16_t>(sign);
+    const uint32_t shift = 126 - (abs >> 23);
+    const uint32_t mantissa = (abs & 0x7fffffu) | 0x800000u;
+    uint32_t h = mantissa >> shift;
+    const uint32_t rest = mantissa & ((1u << shift) - 1);
+    const uint32_t half_way = 1u << (shift - 1);
+    if (rest > half_way || (rest == half_way && (h & 1u)))
+      h++;
+    return static_cast<uint16_t>(sign | h);
+  }
+  uint32_t h = ((abs - 0x38000000u) >> 13);
+  const uint32_t rest = abs & 0x1fffu;
+  if (rest > 0x1000u || (rest == 0x1000u && (h & 1u)))
+    h++;
+  return static_cast<uint16_t>(sign | h);
+}
+
+inline float half_to_float(uint16_t h) {
+  const uint32_t sign = static_cast<uint32_t>(h & 0x8000u) << 16;
+  const uint32_t exponent = (h >> 10) & 0x1fu;
+  uint32_t mantissa = h & 0x3ffu;
+  uint32_t x;
+  if (exponent == 0x1fu) {
+    x = sign | 0x7f800000u | (mantissa << 13);
+  } else if (exponent != 0) {
+    x = sign | ((exponent + 112) << 23) | (mantissa << 13);
+  } else if (mantissa == 0) {
+    x = sign;
+  } else {  // subnormal half, normalize it
+    uint32_t e = 113;
+    while (!(mantissa & 0x400u)) {
+      mantissa <<= 1;
+      e--;
+    }
+    x = sign | (e << 23) | ((mantissa & 0x3ffu) << 13);
+  }
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
@@ -0,0 +1,124 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <vector>
+#include "precision.h"
+#include "tensor.h"
+
+constexpr size_t CACHE_LINE = 64;
+
+/**
+ * \brief n elements starting on a cache line, released with std::free,
+ *        so rows whose size is a multiple of a line never share one
+ */
+template <typename U>
+U* aligned_array(size_t n) {
+  size_t bytes = (n * sizeof(U) + CACHE_LINE - 1) / CACHE_LINE * CACHE_LINE;
+  void* p = std::aligned_alloc(CACHE_LINE, bytes > 0 ? bytes : CACHE_LINE);
+  if (p == nullptr)
+    throw std::bad_alloc();
+  return static_cast<U*>(p);
+}
+
+/**
+ * \brief racy but defined *p += delta: a relaxed atomic load and store,
+ *        a concurrent update may be lost but a value is never torn
+ */
+template <typename W>
+inline void hogwild_add(W* p, T delta) {
+  W v;
+  __atomic_load(p, &v, __ATOMIC_RELAXED);
+  add_rounded(v, delta);
+  __atomic_store(p, &v, __ATOMIC_RELAXED);
+}
+
+/**
+ * \brief racy but defined *p = v, for the codes and norms assigned in place
+ */
+template <typename V>
+inline void hogwild_store(V* p, V v) {
+  __atomic_store(p, &v, __ATOMIC_RELAXED);
+}
+
+struct HogwildStats {
+  uint64_t updates;    // row updates attempted in place
+  uint64_t conflicts;  // of which the row was held by another thread
+};
+
+struct alignas(CACHE_LINE) HogwildCounter {
+  uint64_t updates = 0;
+  uint64_t conflicts = 0;
+};
+
+inline std::vector<HogwildCounter >& hogwild_counters() {
+  static std::vector<HogwildCounter > counters(omp_get_max_threads());
+  return counters;
+}
+
+/**
+ * \return the counters of the calling thread, one cache line each
+ */
+inline HogwildCounter& hogwild_counter() {
+  std::vector<HogwildCounter >& counters = hogwild_counters();
+  return counters[omp_get_thread_num() % counters.size()];
+}
+
+/**
+ * \return the counters summed over the threads since the last reset
+ */
+inline HogwildStats hogwild_stats(bool reset = false) {
+  HogwildStats stats = {0, 0};
+  for (HogwildCounter& c : hogwild_counters()) {
+    stats.updates += c.updates;
+    stats.conflicts += c.conflicts;
+    if (reset)
+      c = HogwildCounter();
+  }
+  return stats;
+}
+
+/**
+ * \brief one writer at a time per row of a parameter in Hogwild mode.
+ *        A thread claims a row before updating it in place and waits
+ *        briefly for a row held by another thread. A row still held is
+ *        a conflict, and the caller diverts the update to the few rows
+ *        it keeps per thread (see GradientAccumulator) instead of
+ *        fighting over the cache lines of a hot row
+ */
+class RowClaims {
+ public:
+  explicit RowClaims(size_type rows) : flags_(rows) {}
+
+  bool claim(size_type r) {
+    HogwildCounter& counter = hogwild_counter();
+    ++counter.updates;
+    for (int spin = 0; spin < CLAIM_SPINS; ++spin) {
+      if (!__atomic_load_n(&flags_[r].busy, __ATOMIC_RELAXED) &&
+          !__atomic_exchange_n(&flags_[r].busy, 1, __ATOMIC_ACQUIRE))
+        return true;
+#if defined(__x86_64__) || defined(__i386__)
+      __builtin_ia32_pause();
+#endif
+    }
+    ++counter.conflicts;
+    return false;
+  }
+  void release(size_type r) {
+    __atomic_store_n(&flags_[r].busy, 0, __ATOMIC_RELEASE);
+  }
+
+ private:
+  // a row is held for the update of one sample, about a microsecond
+  static const int CLAIM_SPINS = 64;
+
+  struct alignas(CACHE_LINE) Flag {
+    uint8_t busy = 0;
+  };
+  std::vector<Flag > flags_;
+};
@@ -2,7 +2,9 @@
 // Created by xinyan on 16/3/2020.
 //
 #pragma once
+#include <algorithm>
 #include <limits>
+#include <numeric>
 #include <utility>
 #include "util.h"
 #include "layer_interface.h"
@@ -11,13 +13,14 @@
 template <Activation Act, bool Select>
 class AbstractLayer : public Interface {
  public:
-  AbstractLayer(size_type I, size_type O) : I_(I), O_(O) {
-    bias_ = new T[O];
+  AbstractLayer(size_type I, size_type O)
+    : I_(I), O_(O), bias_grad_(O, 1), bias_state_(O, 1) {
+    bias_ = aligned_array<T >(O);
     initialize();
   }
 
   virtual ~AbstractLayer() {
-    delete [] bias_;
+    std::free(bias_);
   }
 
   virtual T get_w(size_type i, size_type o) const = 0;
@@ -28,15 +31,23 @@ class AbstractLayer : public Interface {
 
   void initialize();
 
-  SparseVector forward(const SparseVector& x) override;
-
   SparseVector backward(const SparseVector& g,
-                        const SparseVector& x,
+                        const SparseRow& x,
                         const Optimizer& optimizer,
                         bool compute_gx) override {
     SparseVector gx;
     if (compute_gx) {
       gx = backward_x(g, x);
+      if (x.dense_) {
+        // derivative of the previous ReLu, zeros do not pass the gradient
+        SparseVector masked;
+        masked.reserve(gx.size());
+        for (int i = 0; i < x.size(); ++i) {
+          if (x.value_[i] > 0)
+            masked.push_back(gx.index_[i], gx.value_[i]);
+        }
+        gx = std::move(masked);
+      }
     }
     backward_w(g, x, optimizer);
     backward_b(g, x, optimizer);
@@ -44,45 +55,44 @@ class AbstractLayer : public Interface {
   }
 
   virtual SparseVector backward_x(const SparseVector& g,
-                                  const SparseVector& x) {
-    // Compute gradient  with respect to the input:
-    // gx[I_] = w[I_, O_], g[O_].
-    // Previous layer's activation function must be ReLu,
-    // since SoftMax only exist in last layer.
-    SparseVector gx = x;
-    for (int i = 0; i < x.size(); ++i) {
-      T grad = 0;
-      for (int o = 0; o < g.size(); ++o) {
-        grad += g.value_[o] * get_w(x.index_[i], g.index_[o]);
-      }
-      gx.value_[i] = grad;
-    }
-    return gx;
-  }
+                                  const SparseRow& x) = 0;
   virtual void backward_w(const SparseVector& g,
-                          const SparseVector& x,
+                          const SparseRow& x,
                           const Optimizer& optimizer) = 0;
 
   virtual void backward_b(const SparseVector& g,
-                          const SparseVector& x,
+                          const SparseRow& x,
                           const Optimizer& optimizer) {
-    T lr = optimizer.lr;
-    SparseVector gx;
-    volatile T* bias = bias_;
     // update bias (gradient of bias is equivalent to g)
     for (int i = 0; i < g.size(); ++i) {
       T grad = g.value_[i];
       size_type index = g.index_[i];
-      bias[index] -= lr * grad;
+      if (optimizer.accumulate)
+        *bias_grad_.row(index) += grad;
+      else
+        hogwild_add(&bias_[index], bias_state_.delta(
+          optimizer, bias_state_.touch(optimizer, index), 0, grad));
     }
   }
 
+  void apply(const Optimizer& optimizer) override {
+    bias_grad_.apply(bias_, optimizer, bias_state_);
+    bias_state_.tick();
+  }
+
+  void top_k(const TopK& top_k) override {
+    top_k_ = top_k;
+  }
+
  public:
   const size_type  I_;
   const size_type  O_;
 
  protected:
-  T*               bias_;
+  T*                   bias_;
+  GradientAccumulator  bias_grad_;   // shape of [O_, 1]
+  OptimizerState       bias_state_;  // shape of [O_, 1]
+  TopK                 top_k_;       // outputs kept with SoftMax
 };
 
 template <Activation Act, bool Select>
@@ -138,18 +148,249 @@ inline SparseVector softmax(TopSelector<size_type, T>& selector,
   return y;
 }
 
+/**
+ * \brief apply the activation to the raw outputs, a ReLu output that is
+ *        mostly positive is handed to the next layer densely
+ * \param dim output dimension
+ */
 template <Activation Act, bool Select>
-SparseVector AbstractLayer<Act, Select>::forward(const SparseVector& x) {
+inline SparseVector activate(TopSelector<size_type, T>& selector,
+                             SparseVector& y, T max_v, size_type dim) {
+  if constexpr (Act == ReLu) {
+    if (y.size() >= DENSE_RATIO * dim)
+      y.densify(dim);
+    return y;
+  } else {
+    return softmax<Act, Select>(selector, y, max_v);
+  }
+}
+
+/**
+ * \brief receives the scores of a scan, see scan_outputs
+ */
+template <Activation Act, bool Select>
+struct ScanSink {
+  TopSelector<size_type, T>&  selector;
+  SparseVector&               y;
+  T&                          max_v;
+
+  void operator()(size_type o, T mm) const {
+    insert<Act, Select>(o, mm, max_v, selector, y);
+  }
+  /**
+   * \return the score an output has to exceed to be selected, the lowest
+   *         one while fewer than k are kept or without selection
+   */
+  T threshold() const {
+    if constexpr (Act == SoftMax && Select)
+      return selector.threshold();
+    return std::numeric_limits<T>::lowest();
+  }
+};
+
+/**
+ * \brief outputs per thread below which the scan of a sample is not split
+ */
+const size_type SHARD_OUTPUTS = 1 << 14;
+
+/**
+ * \return threads to split the scan of dim outputs over, one inside a
+ *         parallel region where the batch is spread over the threads
+ */
+inline int scan_threads(size_type dim) {
+  if (omp_in_parallel())
+    return 1;
+  const int shards = static_cast<int>(dim / SHARD_OUTPUTS);
+  return std::max(1, std::min(omp_get_max_threads(), shards));
+}
+
+/**
+ * \brief keep the largest values of a softmax output y, sorted by id, as
+ *        long as they add up to less than mass, and the labels among them
+ */
+inline void keep_mass(SparseVector& y, T mass, const size_type* labels,
+                      size_type num_labels) {
+  ArenaVector<size_type > order(y.size());
+  std::iota(order.begin(), order.end(), 0);
+  std::sort(order.begin(), order.end(), [&y](size_type a, size_type b) {
+    return y.value_[a] > y.value_[b];
+  });
+  ArenaVector<char > keep(y.size(), 0);
+  T sum = 0;
+  for (size_type i : order) {
+    if (sum >= mass)
+      break;
+    keep[i] = 1;
+    sum += y.value_[i];
+  }
+  for (size_type l = 0; l < num_labels; ++l) {
+    auto it = std::lower_bound(y.index_.begin(), y.index_.end(), labels[l]);
+    if (it != y.index_.end() && *it == labels[l])
+      keep[it - y.index_.begin()] = 1;
+  }
+  size_type kept = 0;
+  for (size_type i = 0; i < y.size(); ++i) {
+    if (keep[i]) {
+      y.index_[kept] = y.index_[i];
+      y.value_[kept++] = y.value_[i];
+    }
+  }
+  y.index_.resize(kept);
+  y.value_.resize(kept);
+}
+
+/**
+ * \brief score the outputs [0, dim) of one sample and activate them. A
+ *        wide scan is split in shards of whole multiples of align over
+ *        scan_threads(dim) threads, each keeping its own top k and max,
+ *        which are merged before the activation
+ * \param score score(begin, end, emit) calls emit(o, value) for every
+ *              output o of [begin, end) in order; a scan kept to the
+ *              top k may visit them in any order and skip those that
+ *              cannot beat emit.threshold() (see ScanSink)
+ * \param labels true labels to select whatever their score, each scored
+ *               alone by score(label, label + 1, emit)
+ */
+template <Activation Act, bool Select, typename Score>
+SparseVector scan_outputs(size_type dim, const TopK& top_k, Score score,
+                          size_type align = 1,
+                          const size_type* labels = nullptr,
+                          size_type num_labels = 0) {
+  constexpr bool selected = Act == SoftMax && Select;
+  const size_type k = top_k.size(dim);
+  const int threads = scan_threads(dim);
   SparseVector y;
-  TopSelector selector(10 + O_/10);
+  TopSelector selector(k);
   T max_v = std::numeric_limits<T>::min();
-  for (int o = 0; o < this->O_; ++o) {
-    T mm = this->get_b(o);
-    for (int s = 0; s < x.size(); ++s) {
-      size_type i = x.index_[s];
-      mm += x.value_[s] * this->get_w(i, o);
+  if (threads == 1) {
+    score(0, dim, ScanSink<Act, Select>{selector, y, max_v});
+  } else {
+    // the workers have no arena, a shard moves in with its heap allocator
+    vector<SparseVector > parts(threads);
+    vector<T > maxima(threads, max_v);
+#pragma omp parallel num_threads(threads)
+    {
+      const int t = omp_get_thread_num();
+      const size_type n = omp_get_num_threads();
+      const size_type chunk = ((dim + align - 1) / align + n - 1) / n * align;
+      const size_type begin = std::min(dim, t * chunk);
+      const size_type end = std::min(dim, begin + chunk);
+      SparseVector part;
+      TopSelector shard(k);
+      T shard_max = std::numeric_limits<T>::min();
+      score(begin, end, ScanSink<Act, Select>{shard, part, shard_max});
+      if constexpr (selected)
+        parts[t] = shard.select();
+      else
+        parts[t] = std::move(part);
+      maxima[t] = shard_max;
+    }
+
+    for (int t = 0; t < threads; ++t) {
+      max_v = std::max(max_v, maxima[t]);
+      for (int s = 0; s < parts[t].size(); ++s) {
+        if constexpr (selected)
+          selector.insert(parts[t].index_[s], parts[t].value_[s]);
+        else
+          y.push_back(parts[t].index_[s], parts[t].value_[s]);
+      }
     }
-    insert<Act, Select>(o, mm, max_v, selector, y);
   }
-  return softmax<Act, Select>(selector, y, max_v);
+
+  if constexpr (Act == ReLu) {
+    return activate<Act, Select>(selector, y, max_v, dim);
+  } else {
+    if (selected && num_labels > 0) {
+      // the labels left out are scored alone and merged in by id
+      SparseVector top = selector.select();
+      ArenaVector<size_type > ids(labels, labels + num_labels);
+      std::sort(ids.begin(), ids.end());
+      ids.erase(std::unique(ids.begin(), ids.end()), ids.end());
+      SparseVector missing;
+      for (size_type l : ids) {
+        if (l < dim
+            && !std::binary_search(top.index_.begin(), top.index_.end(), l))
+          score(l, l + 1, ScanSink<Act, false>{selector, missing, max_v});
+      }
+      y.reserve(top.size() + missing.size());
+      for (int i = 0, j = 0; i < top.size() || j < missing.size();) {
+        if (j == missing.size()
+            || (i < top.size() && top.index_[i] < missing.index_[j])) {
+          y.push_back(top.index_[i], top.value_[i]);
+          ++i;
+        } else {
+          y.push_back(missing.index_[j], missing.value_[j]);
+          ++j;
+        }
+      }
+      y = softmax<Act, false>(selector, y, max_v);
+    } else {
+      y = softmax<Act, Select>(selector, y, max_v);
+    }
+    if (top_k.mass < 1)
+      keep_mass(y, top_k.mass, labels, num_labels);
+    return y;
+  }
 }
+
+/**
+ * \brief generic forward/backward_x over the weights of `Derived`, which
+ *        are read through a non-virtual call to Derived::get_w, so it
+ *        is inlined into the loops and only the Interface call per
+ *        layer stays virtual
+ */
+template <typename Derived, Activation Act, bool Select>
+class StaticLayer : public AbstractLayer<Act, Select> {
+ public:
+  StaticLayer(size_type I, size_type O) : AbstractLayer<Act, Select>(I, O) {}
+
+  SparseVector forward(const SparseRow& x) override {
+    return forward_labeled(x, nullptr, 0);
+  }
+
+  SparseVector forward_labeled(const SparseRow& x, const size_type* labels,
+                               size_type num_labels) override {
+    // accumulate the rows of the input features into all the outputs
+    ArenaVector<T > buffer(this->O_);
+    T* result = buffer.data();
+    auto score = [&](size_type begin, size_type end, auto&& emit) {
+      std::copy(this->bias_ + begin, this->bias_ + end, result + begin);
+      for (int s = 0; s < x.size(); ++s) {
+        const T xv = x.value_[s];
+        if (xv == 0)
+          continue;
+        const size_type i = x.index_[s];
+        for (size_type o = begin; o < end; ++o) {
+          result[o] += xv * w(i, o);
+        }
+      }
+      for (size_type o = begin; o < end; ++o)
+        emit(o, result[o]);
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score, 1,
+                                     labels, num_labels);
+  }
+
+  SparseVector backward_x(const SparseVector& g,
+                          const SparseRow& x) override {
+    // Compute gradient  with respect to the input:
+    // gx[I_] = w[I_, O_], g[O_].
+    // Previous layer's activation function must be ReLu,
+    // since SoftMax only exist in last layer.
+    SparseVector gx = x;
+    for (int s = 0; s < x.size(); ++s) {
+      const size_type i = x.index_[s];
+      T grad = 0;
+      for (int o = 0; o < g.size(); ++o) {
+        grad += g.value_[o] * w(i, g.index_[o]);
+      }
+      gx.value_[s] = grad;
+    }
+    return gx;
+  }
+
+ protected:
+  T w(size_type i, size_type o) const {
+    return static_cast<const Derived*>(this)->Derived::get_w(i, o);
+  }
+};
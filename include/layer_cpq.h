@@ -4,6 +4,7 @@
 #include <limits>
 #include <utility>
 #include "layer_abstract.h"
+#include "simd.h"
 /**
 * \brief Column-wise Product Vector Quantized Sparse Matrix Multiplication Layer
 */
@@ -14,12 +15,15 @@ template <
 class CPQLayer : public AbstractLayer<Act, Select> {
  public:
   CPQLayer(size_type I, size_type O)
-    : AbstractLayer<Act, Select>(I, O), D_(this->O_/M_) {
+    : AbstractLayer<Act, Select>(I, O), D_(this->O_/M_),
+      dict_grad_(M_ * Ks, D_), dict_claims_(M_ * Ks),
+      dict_state_(M_ * Ks, D_), norm_state_(NQ ? I * M_ : 0, 1),
+      norm_grad_(NQ ? I * M_ : 0, 1) {
     if (this->O_ % M_ > 0)
       throw std::runtime_error("O_ is not dividable by M_");
 
     code_ = new CodeType[this->I_ * M_];
-    dict_ = new T[M_ * Ks * D_];
+    dict_ = aligned_array<T >(M_ * Ks * D_);
     if constexpr (NQ)
       norm_ = new T[this->I_ * M_];
     else
@@ -28,27 +32,37 @@ class CPQLayer : public AbstractLayer<Act, Select> {
   }
   ~CPQLayer() {
     delete [] code_;
-    delete [] dict_;
+    std::free(dict_);
     delete [] norm_;
   }
 
   void initialize();
 
   T get_w(size_type i, size_type o) const override;
-  SparseVector forward(const SparseVector& x) override;
+  SparseVector forward(const SparseRow& x) override;
 
   SparseVector backward_x(const SparseVector& g,
-                          const SparseVector& x) override;
+                          const SparseRow& x) override;
 
-  void backward_w(const SparseVector& x,
-                  const SparseVector& g,
+  void backward_w(const SparseVector& g,
+                  const SparseRow& x,
                   const Optimizer& optimizer) override;
 
+  void apply(const Optimizer& optimizer) override;
+
  private:
   const size_type  D_;     // sub dimension D_ = O_ / M_
   T*               dict_;  // shape of [M_, Ks, D_]
   CodeType *       code_;  // shape of [I_, M_]
   T*               norm_;  // shape of [I_, M_]
+
+  GradientAccumulator       dict_grad_;    // shape of [M_ * Ks, D_]
+  RowClaims                 dict_claims_;  // shape of [M_ * Ks]
+  OptimizerState            dict_state_;   // shape of [M_ * Ks, D_]
+  OptimizerState            norm_state_;   // shape of [I_ * M_, 1] if NQ
+  GradientAccumulator       norm_grad_;    // shape of [I_ * M_, 1] if NQ
+  DeferredWrites<CodeType>  code_writes_;
+  DeferredWrites<T>         norm_writes_;
 };
 
 template <
@@ -113,15 +127,16 @@ template <
   Activation Act, bool Select, bool NQ,
   size_type M_, size_type Ks, typename CodeType>
 SparseVector CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
-::forward(const SparseVector& x) {
+::forward(const SparseRow& x) {
   SparseVector y;
 
   volatile T* dict = dict_;         // shape of [M_, Ks, D_]
   volatile CodeType* code = code_;  // shape of [I_, M_]
-  TopSelector selector(10 + this->O_/10);
+  TopSelector selector(this->top_k_.size(this->O_));
   T max_v = std::numeric_limits<T>::min();
 
-  T* result = new T[this->D_];
+  ArenaVector<T > buffer(this->D_);
+  T* result = buffer.data();
   for (int m = 0, start_idx = 0; m < M_; ++m, start_idx += this->D_) {
     for (int dim = 0; dim < this->D_; ++dim) {
       result[dim] = this->get_b(dim + start_idx);
@@ -141,34 +156,37 @@ SparseVector CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
       insert<Act, Select>(dim + start_idx, result[dim], max_v, selector, y);
     }
   }
-  delete[] result;
-  return softmax<Act, Select>(selector, y, max_v);
+  y = activate<Act, Select>(selector, y, max_v, this->O_);
+  if (Act == SoftMax && this->top_k_.mass < 1)
+    keep_mass(y, this->top_k_.mass, nullptr, 0);
+  return y;
 }
 
 template <
   Activation Act, bool Select, bool NQ,
   size_type M_, size_type Ks, typename CodeType>
 SparseVector CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
-::backward_x(const SparseVector& g, const SparseVector& x) {
-  volatile T* dict = dict_;         // shape of [M_, Ks, D_]
+::backward_x(const SparseVector& g, const SparseRow& x) {
   volatile CodeType* code = code_;  // shape of [I_, M_]
 
-  // calculate look up table:  [M_, Ks]
+  // calculate look up table:  [M_, Ks]. The codewords are the rows of
+  // the output blocks here, so g is scattered once per subspace into a
+  // dense block and the table is Ks contiguous dot products with it
   T tables[M_][Ks];
-
-  for (int k = 0; k < Ks; ++k) {
-    size_type idx = 0;
-    for (int m = 0; m < M_; ++m) {
-      // TODO(Xinyan) to be optimized
-      volatile T* d = dict + m * Ks * D_ + k * D_;
-      T mm = 0;
-      size_type begin_idx = m * D_;
-      size_type end_idx = begin_idx + D_;
-      while (g.size() > idx && g.index_[idx] < end_idx) {
-        mm += g.value_[idx] * d[g.index_[idx] - begin_idx];
-        idx++;
-      }
-      tables[m][k] = mm;
+  const SparseRow g_row(g);
+  ArenaVector<T > buffer(D_);
+  T* gm = buffer.data();
+  size_type idx = 0;
+  for (int m = 0; m < M_; ++m) {
+    size_type begin_idx = m * D_;
+    size_type end_idx = begin_idx + D_;
+    std::fill(gm, gm + D_, 0);
+    for (; g_row.size() > idx && g_row.index_[idx] < end_idx; idx++) {
+      gm[g_row.index_[idx] - begin_idx] = g_row.value_[idx];
+    }
+    const T* d = dict_ + m * Ks * D_;
+    for (int k = 0; k < Ks; ++k, d += D_) {
+      tables[m][k] = dot(D_, gm, d);
     }
   }
 
@@ -199,7 +217,7 @@ template <
 >
 void CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
 ::backward_w(const SparseVector& g,
-             const SparseVector& x,
+             const SparseRow& x,
              const Optimizer& optimizer) {
   // compute gradient and update with respect to the weight
   // gw[i_, o_] = x[1, i_]' g[1, o_]
@@ -207,45 +225,63 @@ void CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
   CodeType* const code = code_;  // shape of [I_, M_]
   T lr = optimizer.lr;
 
-  if (rand() % 10 != 0) {
+  if (layer_random()() % 10 != 0) {
     for (int i = 0; i < x.size(); ++i) {
       size_type o = 0;
       for (int m = 0, begin_idx = 0; m < M_; ++m, begin_idx+=D_) {
         size_type end_idx = begin_idx + D_;
-        auto& c = code[x.index_[i] * M_ + m];
+        const CodeType c = code[x.index_[i] * M_ + m];
         T* weight = &dict[m * Ks * D_ + c * D_];
+        // a codeword still held by another thread is deferred to apply()
+        // as a gradient
+        const size_type r = m * Ks + c;
+        const bool claimed = !optimizer.accumulate && dict_claims_.claim(r);
+        T* const grad_row = claimed ? nullptr : dict_grad_.row(r);
+        const StateRow state = claimed ? dict_state_.touch(optimizer, r)
+                                       : StateRow{nullptr, 0};
 
-        T* norm = nullptr;
+        const size_type slot = x.index_[i] * M_ + m;
+        T norm = 1.0;
         T grad_norm = 0.0;
-        if constexpr (NQ) {
-          norm = &norm_[x.index_[i] * M_ + m];
-        }
+        if constexpr (NQ)
+          norm = norm_[slot];
         for (; g.size() > o && g.index_[o] < end_idx; o++) {
+          const size_type dim = g.index_[o] - begin_idx;
           T grad = g.value_[o] * x.value_[i];
-          if constexpr (NQ) {
-            grad_norm += grad * weight[g.index_[o] - begin_idx];
-            weight[g.index_[o] - begin_idx] -= lr * grad * *norm;
-          } else {
-            weight[g.index_[o] - begin_idx] -= lr * grad;
-          }
+          if constexpr (NQ)
+            grad_norm += grad * weight[dim];
+          if (claimed)
+            hogwild_add(weight + dim, dict_state_.delta(
+              optimizer, state, dim, grad * norm));
+          else
+            grad_row[dim] += grad * norm;
         }
+        if (claimed)
+          dict_claims_.release(r);
         if constexpr (NQ) {
-          *norm -= lr * grad_norm;
+          if (optimizer.accumulate)
+            *norm_grad_.row(slot) += grad_norm;
+          else
+            hogwild_add(&norm_[slot], norm_state_.delta(
+              optimizer, norm_state_.touch(optimizer, slot), 0, grad_norm));
         }
       }
     }
   } else {
-    T * w = new T[D_];
+    ArenaVector<T > buffer(D_);
+    T* w = buffer.data();
     for (int i = 0; i < x.size(); ++i) {
       size_type o = 0;
       for (int m = 0, begin_idx = 0; m < M_; ++m, begin_idx+=D_) {
         size_type end_idx = begin_idx + D_;
-        auto& c = code[x.index_[i] * M_ + m];
+        const size_type slot = x.index_[i] * M_ + m;
+        CodeType c = code[slot];
         std::memcpy(w, &dict[m * Ks * D_ + c * D_], D_ * sizeof(T));
 
-        T* norm = nullptr;
+        T norm_v = 0;
+        T* norm = &norm_v;
         if constexpr (NQ) {
-          norm = &norm_[x.index_[i] * M_ + m];
+          norm_v = norm_[slot];
           for (int dim = 0; dim < D_; ++dim) {
             w[dim] *= *norm;
           }
@@ -260,9 +296,34 @@ void CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
         } else {
           c = static_cast<CodeType>(vq(w, &dict[m * Ks * D_], Ks, D_));
         }
+        // the code (and norm) are assigned, not accumulated
+        if (optimizer.accumulate) {
+          code_writes_.push(slot, c);
+          if constexpr (NQ)
+            norm_writes_.push(slot, norm_v);
+        } else {
+          hogwild_store(code + slot, c);
+          if constexpr (NQ)
+            hogwild_store(norm_ + slot, norm_v);
+        }
       }
     }
+  }
+}
 
-    delete [] w;
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType
+>
+void CPQLayer<Act, Select, NQ, M_, Ks, CodeType>
+  ::apply(const Optimizer& optimizer) {
+  AbstractLayer<Act, Select>::apply(optimizer);
+  dict_grad_.apply(dict_, optimizer, dict_state_);
+  dict_state_.tick();
+  norm_state_.tick();
+  if constexpr (NQ) {
+    norm_grad_.apply(norm_, optimizer, norm_state_);
+    norm_writes_.apply(norm_);
   }
+  code_writes_.apply(code_);
 }
@@ -7,12 +7,17 @@
  */
 #include "layer_abstract.h"
 
-template <Activation Act, bool Select>
-class HashLayer : public AbstractLayer<Act, Select> {
+/**
+ * \param W storage type of the buckets: T, half_t or bfloat16_t
+ */
+template <Activation Act, bool Select, typename W = T>
+class HashLayer
+  : public StaticLayer<HashLayer<Act, Select, W>, Act, Select> {
  public:
   HashLayer(size_type I, size_type O, size_type S)
-  : AbstractLayer<Act, Select>(I, O), S_(S) {
-    bucket_ = new T[S];
+  : StaticLayer<HashLayer<Act, Select, W>, Act, Select>(I, O), S_(S),
+    bucket_grad_(S, 1), bucket_state_(S, 1) {
+    bucket_ = new W[S];
     initialize();
   }
   ~HashLayer() override {
@@ -25,9 +30,9 @@ class HashLayer : public AbstractLayer<Act, Select> {
     std::default_random_engine generator(1016);
     std::uniform_real_distribution<T > dist(
       0.f, 1.f / std::sqrt(this->I_ / 2.0f));
-    T* w = bucket_;
+    W* w = bucket_;
     for (int i = 0; i < this->S_; i++) {
-      *(w++) = dist(generator);
+      *(w++) = from_float<W >(dist(generator));
     }
   }
 
@@ -36,26 +41,37 @@ class HashLayer : public AbstractLayer<Act, Select> {
   }
 
   T get_w(size_type i, size_type o) const override {
-    return bucket_[this->hash(i, o)];
+    return to_float(bucket_[this->hash(i, o)]);
   }
 
 
   void backward_w(const SparseVector& g,
-                  const SparseVector& x,
+                  const SparseRow& x,
                   const Optimizer& optimizer) override {
-    T lr = optimizer.lr;
-
     // compute gradient and update with respect to the weight
     // gw[this->I_, this->O_] = x[1, this->I_]' g[1, this->O_]
     for (int i = 0; i < x.size(); ++i) {
       for (int o = 0; o < g.size(); ++o) {
         T grad = x.value_[i] * g.value_[o];
-        bucket_[this->hash(x.index_[i], g.index_[o]) ]-= lr * grad;
+        size_type h = this->hash(x.index_[i], g.index_[o]);
+        if (optimizer.accumulate)
+          *bucket_grad_.row(h) += grad;
+        else
+          hogwild_add(&bucket_[h], bucket_state_.delta(
+            optimizer, bucket_state_.touch(optimizer, h), 0, grad));
       }
     }
   }
+  void apply(const Optimizer& optimizer) override {
+    AbstractLayer<Act, Select>::apply(optimizer);
+    bucket_grad_.apply(bucket_, optimizer, bucket_state_);
+    bucket_state_.tick();
+  }
+
  public:
   const size_type  S_;  // size of memory usage
  protected:
-  T*               bucket_;
+  W*                   bucket_;
+  GradientAccumulator  bucket_grad_;   // shape of [S_, 1]
+  OptimizerState       bucket_state_;  // shape of [S_, 1]
 };
@@ -15,9 +15,14 @@
 #include <mutex>
 #include <thread>
 
+#include <omp.h>
 #include "vq.h"
 #include "loss.h"
 #include "tensor.h"
+#include "gradient.h"
+#include "hogwild.h"
+#include "optimizer.h"
+#include "quantize.h"
 
 
 using std::mutex;
@@ -25,29 +30,56 @@ using std::vector;
 using std::shared_ptr;
 
 
+/**
+ * \brief random stream of the layers, one per thread so that it is
+ *        reproducible for a fixed number of threads unlike rand()
+ */
+inline std::minstd_rand& layer_random() {
+  static thread_local std::minstd_rand engine(1016 + omp_get_thread_num());
+  return engine;
+}
+
 enum Activation {
   ReLu, SoftMax
 };
 
-typedef struct {
-  T lr;
-} Optimizer;
+/**
+ * \brief outputs kept by a SoftMax layer: the top k of them, then as few
+ *        of those as hold mass of the probability when mass < 1
+ */
+struct TopK {
+  size_type k = 0;  // 0 for 10 + dim / 10
+  T mass = 1;
+
+  size_type size(size_type dim) const {
+    return k > 0 ? std::min(k, dim) : 10 + dim / 10;
+  }
+};
 
 class Interface {
  public:
   /**
  * \brief y = \sigma(xW + b), where sigma is the activation function
- * \param x Sparse Vector
+ * \param x Sparse Row, a view over a record or a previous activation
  * \return y Sparse Vector
  */
-  virtual SparseVector forward(const SparseVector& x) = 0;
+  virtual SparseVector forward(const SparseRow& x) = 0;
+  /**
+   * \brief forward of an output layer in training, the true labels are
+   *        kept among the selected outputs
+   */
+  virtual SparseVector forward_labeled(const SparseRow& x,
+                                       const size_type*,
+                                       size_type) {
+    return forward(x);
+  }
   /**
  * \brief calculated gradient with respect to weight and input
  *        according to formula: g_W = gx; g_b = g; g_I = gW';
  *        update the parameters with Optimization Algorithm:
- *        P -=  lr * Gradient
+ *        P -=  lr * Gradient, or its Adagrad/Adam version
  * \param a current layer output activation
- * \param x sparse vector, memorize input for calculate gradient
+ * \param x sparse row, memorize input for calculate gradient
  *        with respect to weight_
  *
  * \param g gradient with respect to the output of forward
@@ -55,7 +87,29 @@ class Interface {
  * \return gradient with respect to x
  */
   virtual SparseVector backward(const SparseVector& g,
-                                const SparseVector& x,
+                                const SparseRow& x,
                                 const Optimizer& optimizer,
                                 bool compute_gx) = 0;
+  /**
+   * \brief apply the updates deferred by backward since the last call, the
+   *        whole minibatch with Optimizer::accumulate, otherwise the
+   *        Hogwild updates of rows held by another thread, and end the
+   *        step of the optimizer; called after every batch, outside of
+   *        any parallel region, with the optimizer of backward
+   */
+  virtual void apply(const Optimizer& optimizer) = 0;
+  /**
+   * \brief build the int8 inference copy of the current parameters, used
+   *        by infer until the next call; training does not update it
+   */
+  virtual void quantize() {}
+  /**
+   * \brief forward with the int8 copy, the fp32 forward for the layers
+   *        without one or before quantize
+   */
+  virtual SparseVector infer(const SparseRow& x) { return forward(x); }
+  /**
+   * \brief outputs kept by forward when the activation is SoftMax
+   */
+  virtual void top_k(const TopK&) {}
 };
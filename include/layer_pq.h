@@ -3,96 +3,224 @@
 //
 #pragma once
 #include <limits>
+#include <numeric>
 #include "vq.h"
+#include "code_layout.h"
 #include "layer_abstract.h"
+#include "simd.h"
 /**
 * \brief Product Vector Quantized Sparse Matrix Multiplication Layer
+* \param Block 0 to store the codes [O_, M_], otherwise in blocks of Block
+*        outputs scored with vector gathers, see CodeLayout
 */
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_ = 2, size_type Ks = 256, typename CodeType = uint8_t
+  size_type M_ = 2, size_type Ks = 256, typename CodeType = uint8_t,
+  size_type Block = 0
     >
 class PQLayer : public AbstractLayer<Act, Select> {
+  using Layout = CodeLayout<M_, Block>;
+  static_assert(Block == 0 || sizeof(CodeType) == 1,
+                "blocked codes are gathered as uint8");
+  // dimension dim of the codewords c of a subspace that share a cache line
+  // of column(m, dim) is claimed at once, for every dim
+  static constexpr size_type LINE_CODEWORDS = CACHE_LINE / sizeof(T);
+  static_assert(Ks % LINE_CODEWORDS == 0,
+                "a codebook column fills whole cache lines");
+
  public:
   PQLayer(size_type I, size_type O)
-        : AbstractLayer<Act, Select>(I, O), D_(this->I_/M_) {
+        : AbstractLayer<Act, Select>(I, O), D_(this->I_/M_),
+          dict_grad_(M_ * Ks, D_), dict_claims_(M_ * Ks / LINE_CODEWORDS),
+          dict_state_(M_ * Ks, D_),
+          norm_state_(NQ ? Layout::size(O) : 0, 1),
+          norm_grad_(NQ ? Layout::size(O) : 0, 1) {
     if (this->I_ % M_ > 0)
       throw std::runtime_error("I_ is not dividable by M_");
 
-    code_ = new CodeType[this->O_ * M_];
-    dict_ = new T[M_ * Ks * D_];
+    // the padding of the last block is code 0 and norm 0
+    code_ = new CodeType[Layout::size(this->O_)]();
+    dict_ = aligned_array<T >(M_ * Ks * D_);
     if constexpr (NQ)
-      norm_ = new T[this->O_ * M_];
+      norm_ = new T[Layout::size(this->O_)]();
     else
       norm_ = nullptr;
     initialize();
   }
   ~PQLayer() {
     delete [] code_;
-    delete [] dict_;
+    std::free(dict_);
     delete [] norm_;
   }
 
   void initialize();
 
   T get_w(size_type i, size_type o) const override;
-  SparseVector forward(const SparseVector& x) override;
+  SparseVector forward(const SparseRow& x) override {
+    return scan<false>(x);
+  }
+  SparseVector forward_labeled(const SparseRow& x, const size_type* labels,
+                               size_type num_labels) override {
+    return scan<false>(x, labels, num_labels);
+  }
+
+  /**
+   * \brief the tables are built per sample, only the 4-bit codes of a
+   *        layer with Ks = 16 are packed from the current codes, and the
+   *        bounds of a top k output layer are taken from the current
+   *        bias, codes and norms (see pruned_scan)
+   */
+  void quantize() override {
+    quantized_ = true;
+    if constexpr (Ks == 16)
+      packed_.build(code_, this->O_, M_, Layout::slot);
+    if constexpr (PRUNABLE) {
+      prune_order_.clear();
+      if (this->O_ >= PRUNE_GROUP * Ks)
+        build_bounds();
+    }
+  }
+  /**
+   * \brief forward over uint8 lookup tables, summed in int32 per output;
+   *        with NQ the norms weight every table entry and it stays fp32.
+   *        With Ks = 16 the tables fit in registers, see fast_scan,
+   *        otherwise a wide top k output layer skips the outputs that
+   *        cannot be selected unless prune(false), see PRUNABLE
+   */
+  SparseVector infer(const SparseRow& x) override {
+    if (!quantized_)
+      return forward(x);
+    if constexpr (!NQ && Ks == 16)
+      return fast_scan(x);
+    if constexpr (PRUNABLE) {
+      if (prune_ && !prune_order_.empty())
+        return pruned_scan<!NQ>(x);
+    }
+    return scan<!NQ>(x);
+  }
+  /**
+   * \param on skip the outputs of infer below the k-th best score
+   */
+  void prune(bool on) { prune_ = on; }
 
   SparseVector backward_x(const SparseVector& g,
-                          const SparseVector& x) override;
+                          const SparseRow& x) override;
 
   void backward_w(const SparseVector& g,
-                  const SparseVector& x,
+                  const SparseRow& x,
                   const Optimizer& optimizer) override;
 
+  void apply(const Optimizer& optimizer) override;
+
  private:
+  void lookup_tables(const SparseRow& x, T (&tables)[M_][Ks]) const;
+  template <bool Quantized>
+  SparseVector scan(const SparseRow& x, const size_type* labels = nullptr,
+                    size_type num_labels = 0);
+  /**
+   * \brief scan of the packed 4-bit codes a block of 32 outputs at a time
+   */
+  SparseVector fast_scan(const SparseRow& x);
+  /**
+   * \brief groups of the outputs and their bounds for pruned_scan
+   */
+  void build_bounds();
+  /**
+   * \brief top k scan of the outputs grouped by their code of subspace 0.
+   *        The upper bound of a group takes its entry of table 0 and the
+   *        largest entries of the other tables; the groups are visited by
+   *        decreasing bound until it cannot beat the k-th best score so
+   *        far. The outputs of a group come by decreasing bias, and the
+   *        group stops at the first output whose bias plus the bound of
+   *        the group's table (times norm) terms cannot beat it either.
+   *        Without NQ the tables are quantized
+   */
+  template <bool Quantized>
+  SparseVector pruned_scan(const SparseRow& x);
+
+  /**
+   * \return dimension dim of the Ks codewords of subspace m, element c is
+   *         dimension dim of codeword c
+   */
+  T* column(size_type m, size_type dim) const {
+    return dict_ + (m * D_ + dim) * Ks;
+  }
+
   const size_type  D_;     // sub dimension D_ = O_ / M_
-  T*               dict_;  // shape of [M_, Ks, D_]
-  CodeType *       code_;  // shape of [O_, M_]
-  T*               norm_;  // shape of [O_, M_]
+  T*               dict_;  // shape of [M_, D_, Ks], see column()
+  CodeType *       code_;  // shape of [O_, M_], see Layout
+  T*               norm_;  // shape of [O_, M_], see Layout
+
+  GradientAccumulator       dict_grad_;    // shape of [M_ * Ks, D_]
+  RowClaims                 dict_claims_;  // [M_, Ks / LINE_CODEWORDS]
+  OptimizerState            dict_state_;   // shape of [M_ * Ks, D_]
+  OptimizerState            norm_state_;   // shape of norm_ if NQ
+  GradientAccumulator       norm_grad_;    // shape of norm_ if NQ
+  DeferredWrites<CodeType>  code_writes_;
+  DeferredWrites<T>         norm_writes_;
+  bool                      quantized_ = false;
+  PackedCodes4              packed_;  // of code_ if Ks == 16
+
+  // the bound of pruned_scan leaves M_ - 1 subspaces at their largest
+  // entry, too loose to skip much past a few subspaces, and a group
+  // needs enough outputs to pay for sorting the groups per sample
+  static constexpr bool PRUNABLE = Act == SoftMax && Select && M_ <= 4;
+  static constexpr size_type PRUNE_GROUP = 64;
+  vector<size_type >  prune_order_;  // outputs by code 0, then by bias
+  vector<size_type >  prune_start_;  // shape of [Ks + 1], group offsets
+  vector<T >          prune_bias_;   // shape of [Ks], largest bias
+  vector<T >          prune_norm_;   // shape of [Ks, M_, 2] if NQ
+  bool                prune_ = true;
 };
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-void PQLayer<Act, Select, NQ, M_, Ks, CodeType>::initialize() {
+void PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>::initialize() {
   std::default_random_engine generator(1016);
 
+  // drawn output after output whatever the layout
   std::uniform_int_distribution<> codes_dist(0, Ks-1);
-  CodeType* code = this->code_;
-  for (int i = 0; i < M_ * this->O_; ++i) {
-    *(code++) = static_cast<CodeType>(codes_dist(generator));
+  for (int o = 0; o < this->O_; ++o) {
+    for (int m = 0; m < M_; ++m) {
+      code_[Layout::slot(o, m)] = static_cast<CodeType>(codes_dist(generator));
+    }
   }
   std::uniform_real_distribution<T > distribution(0.0, 1.0);
   if constexpr (NQ) {
-    T* norm = norm_;
-    for (int i = 0; i < this->O_ * M_; ++i) {
-      *(norm++) = distribution(generator);
+    for (int o = 0; o < this->O_; ++o) {
+      for (int m = 0; m < M_; ++m) {
+        norm_[Layout::slot(o, m)] = distribution(generator);
+      }
     }
   }
+  // codewords are drawn as rows [M_, Ks, D_], then stored transposed
+  vector<T > codebook(M_ * Ks * D_);
 // #define LEARNED_CODE_BOOK
 #ifndef LEARNED_CODE_BOOK
-  T* w = dict_;
+  T* w = codebook.data();
   for (int i = 0; i < M_ * Ks * D_; i++) {
     *(w++) = distribution(generator);
   }
 #else
-  vq_codebook(dict_, /*n*/65536, Ks, D_, /*iter*/20);
+  vq_codebook(codebook.data(), /*n*/65536, Ks, D_, /*iter*/20);
   for (int i = 1; i < M_; ++i) {
-    std::memcpy(&dict_[i * Ks * D_], dict_, Ks * D_ * sizeof(T));
+    std::memcpy(&codebook[i * Ks * D_], codebook.data(),
+                Ks * D_ * sizeof(T));
   }
 #endif
   if constexpr (NQ) {
-    normalize_codebook(dict_, M_, Ks, D_);
+    normalize_codebook(codebook.data(), M_, Ks, D_);
   }
+  transpose_codebook(dict_, codebook.data(), M_, Ks, D_);
 }
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-T PQLayer<Act, Select, NQ, M_, Ks, CodeType>
+T PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
   ::get_w(size_type i, size_type o) const {
   static size_type count = 0;
   if (count++ == 0)
@@ -102,96 +230,329 @@ T PQLayer<Act, Select, NQ, M_, Ks, CodeType>
     m++;
     i -= D_;
   }
-  CodeType c = code_[o * M_ + m];
+  CodeType c = code_[Layout::slot(o, m)];
   if constexpr (NQ) {
-    return dict_[m * Ks * D_ + c * D_ + i] * norm_[o * M_ + m];
+    return column(m, i)[c] * norm_[Layout::slot(o, m)];
   } else {
-    return dict_[m * Ks * D_ + c * D_ + i];
+    return column(m, i)[c];
   }
 }
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType>
-SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType>
-  ::forward(const SparseVector& x) {
-  SparseVector y;
-
-  volatile T* dict = dict_;         // shape of [M_, Ks, D_]
-  volatile CodeType* code = code_;  // shape of [O_, M_]
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+void PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::lookup_tables(const SparseRow& x, T (&tables)[M_][Ks]) const {
+  // calculate look up table:  [M_, Ks], the nonzeros of x are visited
+  // once, each adds its value times a codebook column to the whole table
+  size_type idx = 0;
+  for (int m = 0; m < M_; ++m) {
+    std::fill(tables[m], tables[m] + Ks, 0);
+    size_type begin_idx = m * D_;
+    size_type end_idx = begin_idx + D_;
+    for (; x.size() > idx && x.index_[idx] < end_idx; idx++) {
+      if (x.value_[idx] == 0)
+        continue;
+      axpy(Ks, x.value_[idx], column(m, x.index_[idx] - begin_idx),
+           tables[m]);
+    }
+  }
+}
 
-  // calculate look up table:  [M_, Ks]
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+template <bool Quantized>
+SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::scan(const SparseRow& x, const size_type* labels, size_type num_labels) {
   T tables[M_][Ks];
+  lookup_tables(x, tables);
 
-  for (int k = 0; k < Ks; ++k) {
-    size_type idx = 0;
-    for (int m = 0; m < M_; ++m) {
-      // TODO(Xinyan) to be optimized
-      volatile T* d = dict + m * Ks * D_ + k * D_;
-      T mm = 0;
-      size_type begin_idx = m * D_;
-      size_type end_idx = begin_idx + D_;
-      while (x.size() > idx && x.index_[idx] < end_idx) {
-        mm += x.value_[idx] * d[x.index_[idx] - begin_idx];
-        idx++;
+  if constexpr (Quantized && Block > 0) {
+    // a block of outputs at once, gathered from the uint8 tables
+    const QuantizedTables<M_, Ks> quantized(tables);
+    auto score = [&](size_type first, size_type last, auto&& emit) {
+      T sum[Block];
+      for (size_type begin = first; begin < last; begin += Block) {
+        const size_type n = std::min(Block, last - begin);
+        quantized.sum(n, code_ + Layout::slot(begin, 0), Block,
+                      this->bias_ + begin, sum);
+        for (int j = 0; j < n; ++j) {
+          emit(begin + j, sum[j]);
+        }
       }
-      tables[m][k] = mm;
-    }
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score, Block,
+                                     labels, num_labels);
+  } else if constexpr (Quantized) {
+    const QuantizedTables<M_, Ks> quantized(tables);
+    auto score = [&](size_type begin, size_type end, auto&& emit) {
+      for (size_type o = begin; o < end; ++o) {
+        emit(o, this->get_b(o)
+             + quantized.sum(code_ + Layout::slot(o, 0), Layout::stride));
+      }
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score, 1,
+                                     labels, num_labels);
   }
 
-  TopSelector selector(10 + this->O_/10);
-  T max_v = std::numeric_limits<T>::min();
-  volatile CodeType* c = code;
-  T* norm = norm_;
+  if constexpr (Block > 0) {
+    // a block of outputs at once, gathered from the table of a subspace
+    auto score = [&](size_type first, size_type last, auto&& emit) {
+      T sum[Block];
+      for (size_type begin = first; begin < last; begin += Block) {
+        const size_type n = std::min(Block, last - begin);
+        const size_type offset = Layout::slot(begin, 0);
+        if constexpr (NQ)
+          gather_sum(n, M_, code_ + offset, Block, tables[0], Ks,
+                     this->bias_ + begin, norm_ + offset, sum);
+        else
+          gather_sum(n, M_, code_ + offset, Block, tables[0], Ks,
+                     this->bias_ + begin, sum);
+        for (int j = 0; j < n; ++j) {
+          emit(begin + j, sum[j]);
+        }
+      }
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score, Block,
+                                     labels, num_labels);
+  }
 
-  for (int o = 0; o < this->O_; ++o) {
-    T mm = this->get_b(o);
+  auto score = [&](size_type begin, size_type end, auto&& emit) {
+    volatile CodeType* c = code_ + begin * M_;  // shape of [O_, M_]
+    T* norm = norm_ + begin * M_;
+    for (size_type o = begin; o < end; ++o) {
+      T mm = this->get_b(o);
 #pragma unroll
-    for (int m = 0; m < M_; ++m) {
-      if constexpr (NQ) {
-        // *c = code[o * M_ + m] * norm_[o * M_ + m]
-        mm += tables[m][*(c++)] * (*(norm++));
-      } else {
-        // *c = code[o * M_ + m]
-        mm += tables[m][*(c++)];
+      for (int m = 0; m < M_; ++m) {
+        if constexpr (NQ) {
+          // *c = code[o * M_ + m] * norm_[o * M_ + m]
+          mm += tables[m][*(c++)] * (*(norm++));
+        } else {
+          // *c = code[o * M_ + m]
+          mm += tables[m][*(c++)];
+        }
+      }
+      emit(o, mm);
+    }
+  };
+  return scan_outputs<Act, Select>(this->O_, this->top_k_, score, 1,
+                                   labels, num_labels);
+}
+
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::fast_scan(const SparseRow& x) {
+  // the uint16 sums of a block hold M_ entries of at most 255
+  static_assert(Ks == 16 && M_ <= 257, "fast scan needs 4-bit codes");
+  T tables[M_][Ks];
+  lookup_tables(x, tables);
+  const QuantizedTables<M_, Ks> quantized(tables);
+
+  const size_type BLOCK = PackedCodes4::BLOCK;
+  auto score = [&](size_type first, size_type last, auto&& emit) {
+    uint16_t sum[PackedCodes4::BLOCK];
+    for (size_type begin = first; begin < last; begin += BLOCK) {
+      fast_scan_block(M_, packed_.block(begin / BLOCK), quantized.q[0], sum);
+      const size_type end = std::min(begin + BLOCK, last);
+      for (size_type o = begin; o < end; ++o) {
+        emit(o, this->get_b(o) + quantized.offset
+             + quantized.step * sum[o - begin]);
       }
     }
+  };
+  return scan_outputs<Act, Select>(this->O_, this->top_k_, score, BLOCK);
+}
+
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+void PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>::build_bounds() {
+  auto group = [this](size_type o) { return code_[Layout::slot(o, 0)]; };
+  prune_order_.resize(this->O_);
+  std::iota(prune_order_.begin(), prune_order_.end(), 0);
+  std::sort(prune_order_.begin(), prune_order_.end(),
+            [&](size_type a, size_type b) {
+              if (group(a) != group(b))
+                return group(a) < group(b);
+              return this->get_b(a) > this->get_b(b)
+                || (this->get_b(a) == this->get_b(b) && a < b);
+            });
 
-    insert<Act, Select>(o, mm, max_v, selector, y);
+  // the largest bias and the min and max norm of every subspace per group
+  prune_start_.assign(Ks + 1, 0);
+  prune_bias_.assign(Ks, std::numeric_limits<T>::lowest());
+  if constexpr (NQ) {
+    prune_norm_.resize(Ks * M_ * 2);
+    for (size_type i = 0; i < prune_norm_.size(); i += 2) {
+      prune_norm_[i] = std::numeric_limits<T>::max();
+      prune_norm_[i + 1] = std::numeric_limits<T>::lowest();
+    }
+  }
+  for (size_type o : prune_order_) {
+    const size_type g = group(o);
+    ++prune_start_[g + 1];
+    prune_bias_[g] = std::max(prune_bias_[g], this->get_b(o));
+    if constexpr (NQ) {
+      for (int m = 0; m < M_; ++m) {
+        const T n = norm_[Layout::slot(o, m)];
+        T* range = &prune_norm_[(g * M_ + m) * 2];
+        range[0] = std::min(range[0], n);
+        range[1] = std::max(range[1], n);
+      }
+    }
   }
+  std::partial_sum(prune_start_.begin(), prune_start_.end(),
+                   prune_start_.begin());
+}
+
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+template <bool Quantized>
+SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::pruned_scan(const SparseRow& x) {
+  T tables[M_][Ks];
+  lookup_tables(x, tables);
 
-  return softmax<Act, Select>(selector, y, max_v);
+  // a bound adds up in the same order as the score it bounds, so the
+  // rounding keeps the score below it
+  auto scan = [this](auto group_bound, auto output_bound, auto output) {
+    // the groups by decreasing bound, rank r starts at position start[r]
+    ArenaVector<T > bound(Ks);
+    ArenaVector<size_type > rank(Ks), start(Ks + 1, 0);
+    for (size_type g = 0; g < Ks; ++g)
+      bound[g] = group_bound(g);
+    std::iota(rank.begin(), rank.end(), 0);
+    std::sort(rank.begin(), rank.end(), [&bound](size_type a, size_type b) {
+      return bound[a] > bound[b] || (bound[a] == bound[b] && a < b);
+    });
+    for (size_type r = 0; r < Ks; ++r) {
+      start[r + 1] = start[r]
+        + prune_start_[rank[r] + 1] - prune_start_[rank[r]];
+    }
+
+    auto score = [&](size_type begin, size_type end, auto&& emit) {
+      size_type r = std::upper_bound(start.begin(), start.end(), begin)
+        - start.begin() - 1;
+      for (; r < Ks && start[r] < end; ++r) {
+        const size_type g = rank[r];
+        if (bound[g] <= emit.threshold())
+          break;  // and so are the groups after it
+        const size_type last = std::min(end, start[r + 1]);
+        for (size_type p = std::max(begin, start[r]); p < last; ++p) {
+          const size_type o = prune_order_[prune_start_[g] + (p - start[r])];
+          if (output_bound(o, g) <= emit.threshold())
+            break;
+          emit(o, output(o));
+        }
+      }
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score);
+  };
+
+  if constexpr (Quantized) {
+    const QuantizedTables<M_, Ks> quantized(tables);
+    int32_t rest = 0;
+    for (int m = 1; m < M_; ++m)
+      rest += *std::max_element(quantized.q[m], quantized.q[m] + Ks);
+    auto bound = [&](T bias, size_type g) {
+      return bias + (quantized.offset + quantized.step
+                     * (quantized.q[0][g] + rest));
+    };
+    return scan(
+      [&](size_type g) { return bound(prune_bias_[g], g); },
+      [&](size_type o, size_type g) { return bound(this->get_b(o), g); },
+      [&](size_type o) {
+        return this->get_b(o)
+          + quantized.sum(code_ + Layout::slot(o, 0), Layout::stride);
+      });
+  } else {
+    static_assert(NQ, "without NQ the pruned scan is quantized");
+    T low[M_], high[M_];
+    for (int m = 0; m < M_; ++m) {
+      low[m] = *std::min_element(tables[m], tables[m] + Ks);
+      high[m] = *std::max_element(tables[m], tables[m] + Ks);
+    }
+    // the largest product of a norm of the group and a table entry, per
+    // subspace, the same for every output of the group
+    ArenaVector<T > terms(Ks * M_);
+    auto bound = [&](T bias, size_type g) {
+      for (int m = 0; m < M_; ++m)
+        bias += terms[g * M_ + m];
+      return bias;
+    };
+    return scan(
+      [&](size_type g) {
+        for (int m = 0; m < M_; ++m) {
+          const T* range = &prune_norm_[(g * M_ + m) * 2];
+          const T lo = m == 0 ? tables[0][g] : low[m];
+          const T hi = m == 0 ? tables[0][g] : high[m];
+          terms[g * M_ + m] =
+            std::max(std::max(range[0] * lo, range[0] * hi),
+                     std::max(range[1] * lo, range[1] * hi));
+        }
+        return bound(prune_bias_[g], g);
+      },
+      [&](size_type o, size_type g) { return bound(this->get_b(o), g); },
+      [&](size_type o) {
+        T mm = this->get_b(o);
+        for (int m = 0; m < M_; ++m) {
+          const size_type slot = Layout::slot(o, m);
+          mm += tables[m][code_[slot]] * norm_[slot];
+        }
+        return mm;
+      });
+  }
 }
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType>
-SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType>
-  ::backward_x(const SparseVector& g, const SparseVector& x) {
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::backward_x(const SparseVector& g, const SparseRow& x) {
   // Compute gradient  with respect to the input:
   // gx[I_] = w[I_, O_], g[O_].
   // Previous layer's activation function must be ReLu,
   // since SoftMax only exist in last layer.
-  T* const dict = dict_;         // shape of [M_, Ks, D_]
   CodeType* const code = code_;  // shape of [O_, M_]
   SparseVector gx = x;
-  gx = x;
+  const SparseRow g_row(g);
+  // with more outputs than codewords, g is first summed per codeword,
+  // then every input is a dot product with its codebook column
+  const bool histogram = g.size() > Ks;
+  ArenaVector<T > buffer(histogram ? Ks : 0);
+  T* h = buffer.data();
   size_type idx = 0;
   for (int m = 0; m < M_; ++m) {
     size_type begin_idx = m * D_;
     size_type end_idx = begin_idx + D_;
+    if (histogram) {
+      std::fill(h, h + Ks, 0);
+      for (int o = 0; o < g.size(); ++o) {
+        const size_type slot = Layout::slot(g_row.index_[o], m);
+        if constexpr (NQ)
+          h[code[slot]] += g.value_[o] * norm_[slot];
+        else
+          h[code[slot]] += g.value_[o];
+      }
+    }
 
     for (; x.size() > idx && x.index_[idx] < end_idx; idx++) {
+      const T* w = column(m, x.index_[idx] - begin_idx);
+      if (histogram) {
+        gx.value_[idx] = dot(Ks, h, w);
+        continue;
+      }
       T grad = 0;
       for (int o = 0; o < g.size(); ++o) {
-        CodeType c = code[g.index_[o] * M_ + m];
-        // TODO(Xinyan) to be optimized
+        const size_type slot = Layout::slot(g_row.index_[o], m);
         if constexpr (NQ) {
-          grad += g.value_[o] * dict[m * Ks * D_ + c * D_ +
-            x.index_[idx] - begin_idx] * norm_[g.index_[o] * M_ + m];
+          grad += g.value_[o] * w[code[slot]] * norm_[slot];
         } else {
-          grad += g.value_[o] * dict[m * Ks * D_ + c * D_ +
-            x.index_[idx] - begin_idx];
+          grad += g.value_[o] * w[code[slot]];
         }
       }
       gx.value_[idx] = grad;
@@ -202,60 +563,79 @@ SparseVector PQLayer<Act, Select, NQ, M_, Ks, CodeType>
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-void PQLayer<Act, Select, NQ, M_, Ks, CodeType>
+void PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
   ::backward_w(const SparseVector& g,
-               const SparseVector& x,
+               const SparseRow& x,
                const Optimizer& optimizer) {
   // compute gradient and update with respect to the weight
   // gw[i_, o_] = x[1, i_]' g[1, o_]
-  T* const dict = dict_;         // shape of [M_, Ks, D_]
   CodeType* const code = code_;  // shape of [O_, M_]
   T lr = optimizer.lr;
 
-  if (rand() % 10 != 0) {
+  if (layer_random()() % 10 != 0) {
     for (int o = 0; o < g.size(); ++o) {
       size_type idx = 0;
       for (int m = 0; m < M_; ++m) {
         size_type begin_idx = m * D_;
         size_type end_idx = begin_idx + D_;
-        auto& c = code[g.index_[o] * M_ + m];
-        T* weight = &dict[m * Ks * D_ + c * D_];
+        const CodeType c = code[Layout::slot(g.index_[o], m)];
+        // a codeword whose lines are still held by another thread is
+        // deferred to apply() as a gradient, dimension dim of codeword c
+        // is column(m, dim)[c]
+        const size_type r = m * Ks + c;
+        const size_type line = r / LINE_CODEWORDS;
+        const bool claimed = !optimizer.accumulate && dict_claims_.claim(line);
+        T* const grad_row = claimed ? nullptr : dict_grad_.row(r);
+        const StateRow state = claimed ? dict_state_.touch(optimizer, r)
+                                       : StateRow{nullptr, 0};
 
-        T* norm = nullptr;
+        const size_type slot = Layout::slot(g.index_[o], m);
+        T norm = 1.0;
         T grad_norm = 0.0;
-        if constexpr (NQ) {
-          norm = &norm_[g.index_[o] * M_ + m];
-        }
+        if constexpr (NQ)
+          norm = norm_[slot];
         for (; x.size() > idx && x.index_[idx] < end_idx; idx++) {
+          const size_type dim = x.index_[idx] - begin_idx;
           T grad = x.value_[idx] * g.value_[o];
-          if constexpr (NQ) {
-            grad_norm += grad * weight[x.index_[idx] - begin_idx];
-            weight[x.index_[idx] - begin_idx] -= lr * grad * *norm;
-          } else {
-            weight[x.index_[idx] - begin_idx] -= lr * grad;
-          }
-
+          if constexpr (NQ)
+            grad_norm += grad * column(m, dim)[c];
+          if (claimed)
+            hogwild_add(&column(m, dim)[c], dict_state_.delta(
+              optimizer, state, dim, grad * norm));
+          else
+            grad_row[dim] += grad * norm;
         }
+        if (claimed)
+          dict_claims_.release(line);
         if constexpr (NQ) {
-          *norm -= lr * grad_norm;
+          if (optimizer.accumulate)
+            *norm_grad_.row(slot) += grad_norm;
+          else
+            hogwild_add(&norm_[slot], norm_state_.delta(
+              optimizer, norm_state_.touch(optimizer, slot), 0, grad_norm));
         }
       }
     }
   } else {
-    T * w = new T[D_];
+    ArenaVector<T > buffer(D_);
+    T* w = buffer.data();
     for (int o = 0; o < g.size(); ++o) {
       size_type idx = 0;
       for (int m = 0; m < M_; ++m) {
         size_type begin_idx = m * D_;
         size_type end_idx = begin_idx + D_;
-        auto& c = code[g.index_[o] * M_ + m];
-        std::memcpy(w, &dict[m * Ks * D_ + c * D_], D_ * sizeof(T));
+        const size_type slot = Layout::slot(g.index_[o], m);
+        CodeType c = code[slot];
+        for (int dim = 0; dim < D_; ++dim) {
+          w[dim] = column(m, dim)[c];
+        }
 
-        T* norm = nullptr;
+        T norm_v = 0;
+        T* norm = &norm_v;
         if constexpr (NQ) {
-          norm = &norm_[g.index_[o] * M_ + m];
+          norm_v = norm_[slot];
           for (int dim = 0; dim < D_; ++dim) {
             w[dim] *= *norm;
           }
@@ -265,13 +645,47 @@ void PQLayer<Act, Select, NQ, M_, Ks, CodeType>
           w[x.index_[idx] - begin_idx] -= lr * grad;
         }
         if constexpr (NQ) {
-          c = static_cast<CodeType>(nvq(norm, w, &dict[m * Ks * D_], Ks, D_));
+          c = static_cast<CodeType>(
+            nvq_transposed(norm, w, column(m, 0), Ks, D_));
+        } else {
+          c = static_cast<CodeType>(vq_transposed(w, column(m, 0), Ks, D_));
+        }
+        // the code (and norm) are assigned, not accumulated
+        if (optimizer.accumulate) {
+          code_writes_.push(slot, c);
+          if constexpr (NQ)
+            norm_writes_.push(slot, norm_v);
         } else {
-          c = static_cast<CodeType>(vq(w, &dict[m * Ks * D_], Ks, D_));
+          hogwild_store(code + slot, c);
+          if constexpr (NQ)
+            hogwild_store(norm_ + slot, norm_v);
         }
       }
     }
-    delete [] w;
   }
 
-}
\ No newline at end of file
+}
+
+template <
+  Activation Act, bool Select, bool NQ,
+  size_type M_, size_type Ks, typename CodeType, size_type Block
+>
+void PQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::apply(const Optimizer& optimizer) {
+  AbstractLayer<Act, Select>::apply(optimizer);
+  // codeword r is strided over the columns of its subspace
+  dict_grad_.apply([&](size_type r, const T* grad) {
+    const size_type m = r / Ks, c = r % Ks;
+    const StateRow state = dict_state_.touch(optimizer, r);
+    for (size_type dim = 0; dim < D_; ++dim) {
+      column(m, dim)[c] += dict_state_.delta(optimizer, state, dim, grad[dim]);
+    }
+  });
+  dict_state_.tick();
+  norm_state_.tick();
+  if constexpr (NQ) {
+    norm_grad_.apply(norm_, optimizer, norm_state_);
+    norm_writes_.apply(norm_);
+  }
+  code_writes_.apply(code_);
+}
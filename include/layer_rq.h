@@ -3,19 +3,29 @@
 //
 #pragma once
 #include <limits>
+#include <optional>
+#include "code_layout.h"
+#include "simd.h"
 
 /**
 * \brief Residual Vector Quantized Sparse Matrix Multiplication Layer
+* \param Block 0 to store the codes [O_, M_], otherwise in blocks of Block
+*        outputs scored with vector gathers, see CodeLayout
 */
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_=2, size_type Ks = 256, typename CodeType = uint8_t
+  size_type M_=2, size_type Ks = 256, typename CodeType = uint8_t,
+  size_type Block = 0
     >
 class RQLayer : public AbstractLayer<Act, Select> {
+  using Layout = CodeLayout<M_, Block>;
+  static_assert(Block == 0 || sizeof(CodeType) == 1,
+                "blocked codes are gathered as uint8");
+
  public:
   RQLayer(size_type I, size_type O)
         : AbstractLayer<Act, Select>(I, O) {
-    code_ = new CodeType[O * M_];
+    code_ = new CodeType[Layout::size(O)]();
     dict_ = new T[M_ * Ks * I];
     norm_ = new T[O];
     initialize();
@@ -30,32 +40,58 @@ class RQLayer : public AbstractLayer<Act, Select> {
 
   void initialize();
   T get_w(size_type i, size_type o) const override;
-  SparseVector forward(const SparseVector& x) override;
+  SparseVector forward(const SparseRow& x) override {
+    return scan<false>(x);
+  }
+
+  // the tables are built per sample, only the flag is kept
+  void quantize() override { quantized_ = true; }
+  /**
+   * \brief forward over uint8 lookup tables, summed in int32 per output
+   */
+  SparseVector infer(const SparseRow& x) override {
+    return quantized_ ? scan<true>(x) : forward(x);
+  }
 
   SparseVector backward_x(const SparseVector& g,
-                          const SparseVector& x) override;
+                          const SparseRow& x) override;
 
   void backward_w(const SparseVector& g,
-                  const SparseVector& x,
+                  const SparseRow& x,
                   const Optimizer& optimizer) override;
 
+  void apply(const Optimizer& optimizer) override {
+    AbstractLayer<Act, Select>::apply(optimizer);
+    code_writes_.apply(code_);
+    norm_writes_.apply(norm_);
+  }
+
  protected:
+  template <bool Quantized>
+  SparseVector scan(const SparseRow& x);
+
   T*               norm_;  //
   T*               dict_;  // shape of [R_, Ks, I_]
-  CodeType *       code_;  // shape of [O_, R_]
+  CodeType *       code_;  // shape of [O_, R_], see Layout
+
+  DeferredWrites<CodeType>  code_writes_;
+  DeferredWrites<T>         norm_writes_;
+  bool                      quantized_ = false;
 };
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-void RQLayer<Act, Select, NQ, M_, Ks, CodeType>::initialize() {
+void RQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>::initialize() {
   std::default_random_engine generator(1016);
 
+  // drawn output after output whatever the layout
   std::uniform_int_distribution<> codes_dist(0, Ks-1);
-  CodeType* code = code_;
-  for (int i = 0; i < M_ * this->O_; ++i) {
-    *(code++) = static_cast<CodeType>(codes_dist(generator));
+  for (int o = 0; o < this->O_; ++o) {
+    for (int m = 0; m < M_; ++m) {
+      code_[Layout::slot(o, m)] = static_cast<CodeType>(codes_dist(generator));
+    }
   }
 
   std::uniform_real_distribution<T > distribution(0.0, 1.0);
@@ -78,16 +114,16 @@ void RQLayer<Act, Select, NQ, M_, Ks, CodeType>::initialize() {
 
 template <
   Activation Act, bool Select,bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-T RQLayer<Act, Select, NQ, M_, Ks, CodeType>
+T RQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
   ::get_w(size_type i, size_type o) const {
   static size_type count = 0;
   if (count++ == 0)
     std::cerr << "Not efficient, for test only" << std::endl;
   T w = 0;
   for (int m = 0; m < M_; ++m) {
-    CodeType c = code_[o * M_ + m];
+    CodeType c = code_[Layout::slot(o, m)];
     w += dict_[m * Ks * this->I_ + c * this->I_ + i];
   }
   return w * norm_[o];
@@ -95,10 +131,11 @@ T RQLayer<Act, Select, NQ, M_, Ks, CodeType>
 
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType
+  size_type M_, size_type Ks, typename CodeType, size_type Block
   >
-SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
-  ::forward(const SparseVector& x) {
+template <bool Quantized>
+SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::scan(const SparseRow& x) {
   SparseVector y;
 
   volatile T* dict = dict_;         // shape of [M_, Ks, I_]
@@ -120,14 +157,49 @@ SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
   volatile T* norm = norm_;
   volatile CodeType* c = code;
 
-  TopSelector selector(10 + this->O_/10);
+  TopSelector selector(this->top_k_.size(this->O_));
   T max_v = std::numeric_limits<T>::min();
 
+  std::optional<QuantizedTables<M_, Ks> > quantized;
+  if constexpr (Quantized)
+    quantized.emplace(tables);
+
+  if constexpr (Block > 0) {
+    // a block of outputs at once, gathered from the table of a subspace
+    T sum[Block];
+    for (size_type begin = 0; begin < this->O_; begin += Block) {
+      const size_type n = std::min(Block, this->O_ - begin);
+      if constexpr (Quantized)
+        quantized->sum(n, code_ + Layout::slot(begin, 0), Block,
+                       this->bias_ + begin, sum);
+      else
+        gather_sum(n, M_, code_ + Layout::slot(begin, 0), Block, tables[0],
+                   Ks, this->bias_ + begin, sum);
+      for (int j = 0; j < n; ++j) {
+        const size_type o = begin + j;
+        const T mm = sum[j] * norm[o];
+        if (mm > 0) {
+          y.push_back(o, mm);
+        }
+        insert<Act, Select>(o, mm, max_v, selector, y);
+      }
+    }
+    y = activate<Act, Select>(selector, y, max_v, this->O_);
+    if (Act == SoftMax && this->top_k_.mass < 1)
+      keep_mass(y, this->top_k_.mass, nullptr, 0);
+    return y;
+  }
+
   for (int o = 0; o < this->O_; ++o) {
     T mm = this->get_b(o);
+    if constexpr (Quantized) {
+      mm += quantized->sum(code_ + Layout::slot(o, 0), Layout::stride);
+      c += M_;
+    } else {
 #pragma unroll
-    for (int m = 0; m < M_; ++m) {
-      mm += tables[m][*(c++)];  // *c = code[o * M_ + m]
+      for (int m = 0; m < M_; ++m) {
+        mm += tables[m][*(c++)];  // *c = code[o * M_ + m]
+      }
     }
     mm *= *(norm++);
     if (mm > 0) {
@@ -137,12 +209,16 @@ SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
     insert<Act, Select>(o, mm, max_v, selector, y);
   }
 
-  return softmax<Act, Select>(selector, y, max_v);
+  y = activate<Act, Select>(selector, y, max_v, this->O_);
+  if (Act == SoftMax && this->top_k_.mass < 1)
+    keep_mass(y, this->top_k_.mass, nullptr, 0);
+  return y;
 }
 
-template <Activation Act, bool Select, bool NQ, size_type M_, size_type Ks, typename CodeType>
-SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
-  ::backward_x(const SparseVector& g, const SparseVector& x) {
+template <Activation Act, bool Select, bool NQ, size_type M_, size_type Ks,
+          typename CodeType, size_type Block>
+SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
+  ::backward_x(const SparseVector& g, const SparseRow& x) {
 //  return AbstractLayer::backward_x(g, x);
   T* const norm = norm_;         // shape of [O_]
   CodeType* const code = code_;  // shape of [O_, M_]
@@ -156,7 +232,7 @@ SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
   for (int o = 0; o < g.size(); ++o) {
     T grad_o = g.value_[o] * norm[g.index_[o]];
     for (int m = 0; m < M_; ++m) {
-      CodeType c = code[g.index_[o] * M_ + m];
+      CodeType c = code[Layout::slot(g.index_[o], m)];
       T* d = &dict_[m * Ks * this->I_ + c * this->I_];
       for (int idx = 0; idx < x.size(); ++idx) {
         gx.value_[idx] += d[x.index_[idx]] * grad_o;
@@ -167,10 +243,10 @@ SparseVector RQLayer<Act, Select, NQ, M_, Ks, CodeType>
 }
 template <
   Activation Act, bool Select, bool NQ,
-  size_type M_, size_type Ks, typename CodeType>
-void RQLayer<Act, Select, NQ, M_, Ks, CodeType>
+  size_type M_, size_type Ks, typename CodeType, size_type Block>
+void RQLayer<Act, Select, NQ, M_, Ks, CodeType, Block>
   ::backward_w(const SparseVector& g,
-               const SparseVector& x,
+               const SparseRow& x,
                const Optimizer& optimizer) {
   T lr = optimizer.lr;
   SparseVector gx;
@@ -179,11 +255,12 @@ void RQLayer<Act, Select, NQ, M_, Ks, CodeType>
   CodeType* const code = code_;  // shape of [O_, M_]
   // compute gradient and update with respect to the weight
   // gw[i_, o_] = x[1, i_]' g[1, o_]
-  T * w = new T[this->I_];
+  ArenaVector<T > buffer(this->I_);
+  T* w = buffer.data();
   for (int o = 0; o < g.size(); ++o) {
     std::memset(w, 0, this->I_ * sizeof(T));
     for (int m = 0; m < M_; ++m) {
-      auto& c = code[g.index_[o] * M_ + m];
+      auto& c = code[Layout::slot(g.index_[o], m)];
       T* d = &dict[m * Ks * this->I_ + c * this->I_];
       for (int i = 0; i < this->I_; ++i) {
         w[i] += d[i];
@@ -199,7 +276,20 @@ void RQLayer<Act, Select, NQ, M_, Ks, CodeType>
       T grad = x.value_[idx] * grad_o;
       w[x.index_[idx]] -= lr * grad;
     }
-    rq(w, dict, &code[g.index_[o] * M_], &norm[g.index_[o]], Ks, M_, this->I_);
+    CodeType codes[M_];
+    T norm_w = 0;
+    rq(w, dict, codes, &norm_w, Ks, M_, this->I_);
+    if (optimizer.accumulate) {
+      // the codes and the norm are assigned, not accumulated
+      for (int m = 0; m < M_; ++m) {
+        code_writes_.push(Layout::slot(g.index_[o], m), codes[m]);
+      }
+      norm_writes_.push(g.index_[o], norm_w);
+    } else {
+      for (int m = 0; m < M_; ++m) {
+        hogwild_store(code + Layout::slot(g.index_[o], m), codes[m]);
+      }
+      hogwild_store(norm + g.index_[o], norm_w);
+    }
   }
-  delete [] w;
 }
\ No newline at end of file
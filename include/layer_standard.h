@@ -6,24 +6,29 @@
  * \brief Sparse Matrix Multiplication Layer
  */
 #include "layer_abstract.h"
+#include "simd.h"
 
-template <Activation Act, bool Select>
-class Layer : public AbstractLayer<Act, Select> {
+/**
+ * \param W storage type of the weights: T, half_t or bfloat16_t
+ */
+template <Activation Act, bool Select, typename W = T>
+class Layer : public StaticLayer<Layer<Act, Select, W>, Act, Select> {
  public:
   Layer(size_type I, size_type O)
-  : AbstractLayer<Act, Select>(I, O) {
-    weight_ = new T[I * O];
+  : StaticLayer<Layer<Act, Select, W>, Act, Select>(I, O),
+    weight_grad_(I, O), weight_claims_(I), weight_state_(I, O) {
+    weight_ = aligned_array<W >(I * O);
     initialize();
   }
   ~Layer() override {
-    delete [] weight_;
+    std::free(weight_);
   }
 
-  const T* weight() { return this->weight_; }
+  const W* weight() { return this->weight_; }
   const T* bias() { return this->bias_; }
 
   void initialize(const vector<T >& w, const vector<T >& b) {
-    std::memcpy(this->weight_, w.data(), w.size() * sizeof(T));
+    std::transform(w.begin(), w.end(), this->weight_, from_float<W >);
     std::memcpy(this->bias_, b.data(), b.size() * sizeof(T));
   }
 
@@ -32,35 +37,153 @@ class Layer : public AbstractLayer<Act, Select> {
     std::default_random_engine generator(1016);
     std::uniform_real_distribution<T > dist(
       0.f, 1.f / std::sqrt(this->I_ / 2.0f));
-    T* w = weight_;
+    W* w = weight_;
     for (int i = 0; i < this->I_; i++) {
       for (int j = 0; j < this->O_; j++) {
-        *(w++) = dist(generator);
+        *(w++) = from_float<W >(dist(generator));
       }
     }
   }
 
   T get_w(size_type i, size_type o) const override {
-    return weight_[i * this->O_ + o];
+    return to_float(weight_[i * this->O_ + o]);
+  }
+
+  /**
+   * \brief row-oriented forward: one vectorized AXPY of a weight row per
+   *        nonzero input into the output accumulator
+   */
+  SparseVector forward(const SparseRow& x) override {
+    return forward_labeled(x, nullptr, 0);
+  }
+
+  SparseVector forward_labeled(const SparseRow& x, const size_type* labels,
+                               size_type num_labels) override {
+    ArenaVector<T > buffer(this->O_);
+    T* result = buffer.data();
+    // a shard of the outputs accumulates its slice of the weight rows
+    auto score = [&](size_type begin, size_type end, auto&& emit) {
+      std::copy(this->bias_ + begin, this->bias_ + end, result + begin);
+      for (int s = 0; s < x.size(); ++s) {
+        if (x.value_[s] == 0)
+          continue;
+        axpy(end - begin, x.value_[s],
+             weight_ + x.index_[s] * this->O_ + begin, result + begin);
+      }
+      for (size_type o = begin; o < end; ++o)
+        emit(o, result[o]);
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score, 1,
+                                     labels, num_labels);
+  }
+
+  SparseVector backward_x(const SparseVector& g,
+                          const SparseRow& x) override {
+    // gx[i] = w[i, :] g, a dot product with the weight row of every input
+    const bool dense_g = g.size() == this->O_;
+    SparseVector gx = x;
+    for (int s = 0; s < x.size(); ++s) {
+      const W* w = weight_ + x.index_[s] * this->O_;
+      gx.value_[s] = dense_g
+        ? dot(this->O_, g.value_.data(), w)
+        : sparse_dot(g.size(), g.index_.data(), g.value_.data(), w);
+    }
+    return gx;
   }
 
   void backward_w(const SparseVector& g,
-                  const SparseVector& x,
+                  const SparseRow& x,
                   const Optimizer& optimizer) override {
-    T lr = optimizer.lr;
-    volatile T* weight = weight_;
-
     // compute gradient and update with respect to the weight
     // gw[this->I_, this->O_] = x[1, this->I_]' g[1, this->O_]
-    for (int i = 0; i < x.size(); ++i) {
-      volatile T* w = weight + this->O_ * x.index_[i];
-      for (int o = 0; o < g.size(); ++o) {
-        T grad = x.value_[i] * g.value_[o];
-        w[g.index_[o]] -= lr * grad;
+    for (int s = 0; s < x.size(); ++s) {
+      if (x.value_[s] == 0)
+        continue;
+      const size_type r = x.index_[s];
+      if (!optimizer.accumulate && weight_claims_.claim(r)) {
+        update_row(weight_ + this->O_ * r, r, x.value_[s], g, optimizer);
+        weight_claims_.release(r);
+      } else if (g.size() == this->O_) {
+        axpy(this->O_, x.value_[s], g.value_.data(), weight_grad_.row(r));
+      } else {
+        sparse_axpy(g.size(), x.value_[s], g.index_.data(), g.value_.data(),
+                    weight_grad_.row(r));
       }
     }
   }
 
+  void quantize() override {
+    weight_int8_.build(weight_, this->I_, this->O_);
+  }
+
+  /**
+   * \brief the row scales fold into the input, quantized to int8 as a
+   *        whole, so the products accumulate in int32 and are rescaled
+   *        once per output
+   */
+  SparseVector infer(const SparseRow& x) override {
+    if (weight_int8_.empty())
+      return forward(x);
+    ArenaVector<T > scaled(x.size());
+    T max_abs = 0;
+    for (int s = 0; s < x.size(); ++s) {
+      scaled[s] = x.value_[s] * weight_int8_.scale[x.index_[s]];
+      max_abs = std::max(max_abs, std::abs(scaled[s]));
+    }
+    const T step = max_abs / 127;
+    const T inverse = max_abs > 0 ? 127 / max_abs : 0;
+
+    ArenaVector<int32_t > acc(this->O_, 0);
+    const int8_t* q = weight_int8_.q.data();
+    auto score = [&](size_type begin, size_type end, auto&& emit) {
+      const size_type n = end - begin;
+      int32_t* sum = acc.data() + begin;
+      const int8_t* pending = nullptr;
+      int16_t pending_a = 0;
+      for (int s = 0; s < x.size(); ++s) {
+        const int16_t a = quantize_int8(scaled[s], inverse);
+        if (a == 0)
+          continue;
+        const int8_t* row = q + x.index_[s] * this->O_ + begin;
+        if (pending == nullptr) {
+          pending = row;
+          pending_a = a;
+        } else {
+          accumulate_int8(n, pending_a, pending, a, row, sum);
+          pending = nullptr;
+        }
+      }
+      if (pending != nullptr)
+        accumulate_int8(n, pending_a, pending, 0, pending, sum);
+      for (size_type o = begin; o < end; ++o)
+        emit(o, this->bias_[o] + step * acc[o]);
+    };
+    return scan_outputs<Act, Select>(this->O_, this->top_k_, score);
+  }
+
+  void apply(const Optimizer& optimizer) override {
+    AbstractLayer<Act, Select>::apply(optimizer);
+    weight_grad_.apply(weight_, optimizer, weight_state_);
+    weight_state_.tick();
+  }
+
  protected:
-  T*               weight_;
+  /**
+   * \brief w[:] += update of row r of the weights for the input value xv,
+   *        in place: the row is claimed but read by the other threads
+   */
+  void update_row(W* w, size_type r, T xv, const SparseVector& g,
+                  const Optimizer& optimizer) {
+    const StateRow state = weight_state_.touch(optimizer, r);
+    for (int o = 0; o < g.size(); ++o) {
+      hogwild_add(w + g.index_[o], weight_state_.delta(
+        optimizer, state, g.index_[o], xv * g.value_[o]));
+    }
+  }
+
+  W*                   weight_;
+  GradientAccumulator  weight_grad_;    // shape of [I_, O_]
+  RowClaims            weight_claims_;  // shape of [I_]
+  OptimizerState       weight_state_;   // shape of [I_, O_]
+  Int8Matrix           weight_int8_;    // shape of [I_, O_]
 };
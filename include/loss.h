@@ -11,10 +11,16 @@ class SoftMaxCrossEntropy {
  public:
   /**
    * \param p SoftMax estimate
-   * \param y true labels for classification task,
+   * \param y true labels for classification task, sorted
+   * \param num_labels size of y
    * \return gradient with respect to the pre-SoftMax output
    *         according to formula: g_i = p_i - y_i
    */
+  static SparseVector compute(const SparseVector& p, const size_type* y,
+                              size_type num_labels, T* loss);
+
   static SparseVector compute(const SparseVector& p,
-                              const vector<size_type >& y, T* loss);
+                              const vector<size_type >& y, T* loss) {
+    return compute(p, y.data(), static_cast<size_type>(y.size()), loss);
+  }
 };
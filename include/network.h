@@ -9,15 +9,55 @@ using namespace std;
 
 class Network {
  public:
+  /**
+   * \param precision storage of the weights of the dense layers, a
+   *                  network without one throws unless FP32
+   * \param fast_scan a PQ output layer has 4-bit codes (Ks = 16),
+   *                  scored in registers once quantized
+   */
   Network(int* layer_size, int num_layers, int batch_size,
-          const Optimizer& optimizer, int input_dim);
-  int predict(int **input_indices, float **input_values,
-              int *length, int **labels, int *label_size);
-  float train(int **input_indices, float **input_values,
-              int *lengths, int **labels, int *label_size);
+          const Optimizer& optimizer, int input_dim,
+          Precision precision = FP32, bool fast_scan = false);
+  /**
+   * \brief predict every row of the batch in one parallel loop, it can be
+   *        larger than batch_size to evaluate a whole split at once. A
+   *        batch smaller than the threads is predicted a row at a time,
+   *        each splitting the scan of a wide layer
+   * \param quantized use the int8 copies built by quantize()
+   * \return number of samples whose top prediction is a true label
+   */
+  int predict(const SparseBatch& batch, bool quantized = false);
+  /**
+   * \brief outputs kept by the SoftMax output layer, which keeps the true
+   *        labels too in training
+   */
+  void top_k(const TopK& top_k);
+  /**
+   * \brief build the int8 inference copies of the layers from the
+   *        current weights, see Interface::quantize
+   */
+  void quantize();
+  /**
+   * \return number of samples whose top prediction is the same with the
+   *         fp32 and the int8 layers
+   */
+  int agreement(const SparseBatch& batch);
+  /**
+   * \brief one SGD step per row of the batch, the rows are read in place
+   * \return sum of the losses over the batch
+   */
+  float train(const SparseBatch& batch);
   void save_weight(string file);
   ~Network();
  private:
+  size_type top1(const SparseRow& x, bool quantized);
+  /**
+   * \return whether the rows of a batch are spread over the threads,
+   *         otherwise they are scored one at a time and the wide layers
+   *         split their outputs over the threads (see scan_outputs)
+   */
+  bool across_batch(size_type rows) const;
+
   size_type              batch_size_;
   size_type              num_layers_;
   size_type              input_dim_;
@@ -0,0 +1,159 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "hogwild.h"
+#include "tensor.h"
+
+using std::vector;
+
+enum Method {
+  SGD, Adagrad, Adam
+};
+
+typedef struct {
+  T lr;
+  // accumulate the gradients of a minibatch per thread and step once per
+  // row in Interface::apply, instead of updating in place per sample
+  // (Hogwild, where a row held by another thread is deferred the same way)
+  bool accumulate;
+  Method method = SGD;
+  T beta1 = 0.9;    // Adam decay of the first moment
+  T beta2 = 0.999;  // Adam decay of the second moment
+  T eps = 1e-8;
+} Optimizer;
+
+/**
+ * \brief a row of OptimizerState being updated
+ */
+struct StateRow {
+  T* s;     // Adagrad sums or Adam moments [m, v] of the row
+  T  step;  // learning rate, bias corrected for Adam
+};
+
+/**
+ * \brief Adagrad/Adam state of a parameter of shape [rows, width], kept
+ *        only for the rows that have been updated. With accumulate, a
+ *        row is touched once per step by GradientAccumulator::apply,
+ *        steps are counted by tick(), once per batch, and a row missing
+ *        some steps is caught up when it is touched again: the Adam
+ *        moments are decayed as if the gradients in between had been
+ *        zero. In Hogwild mode a row is touched per sample, and its steps
+ *        are its own updates; concurrent updates of a row are racy but
+ *        defined, like the Hogwild weights
+ */
+class OptimizerState {
+ public:
+  OptimizerState(size_type rows, size_type width)
+    : width_(width),
+      page_rows_(std::max<size_type>(1, CACHE_LINE / sizeof(T) / width)),
+      pages_((rows + page_rows_ - 1) / page_rows_, nullptr),
+      stamp_(rows, 0) {}
+  ~OptimizerState() {
+    for (T* page : pages_)
+      delete [] page;
+  }
+  OptimizerState(const OptimizerState&) = delete;
+  OptimizerState& operator=(const OptimizerState&) = delete;
+
+  /**
+   * \brief start an update of row r
+   * \return the state of the row for delta(), empty with SGD
+   */
+  StateRow touch(const Optimizer& optimizer, size_type r) {
+    if (optimizer.method == SGD)
+      return {nullptr, optimizer.lr};
+    T* s = row(r);
+    T step = optimizer.lr;
+    if (optimizer.method == Adam) {
+      uint32_t t;
+      if (optimizer.accumulate) {
+        t = step_ + 1;
+        const uint32_t last = stamp_[r];
+        stamp_[r] = t;
+        // the steps strictly between the last update and this one, the
+        // moments of this step are decayed by delta()
+        if (t - last > 1) {
+          const T decay1 = std::pow(optimizer.beta1, T(t - last - 1));
+          const T decay2 = std::pow(optimizer.beta2, T(t - last - 1));
+          for (size_type k = 0; k < width_; ++k) {
+            store(s + k, load(s + k) * decay1);
+            store(s + width_ + k, load(s + width_ + k) * decay2);
+          }
+        }
+      } else {
+        t = __atomic_add_fetch(&stamp_[r], 1, __ATOMIC_RELAXED);
+      }
+      step *= std::sqrt(1 - std::pow(optimizer.beta2, T(t)))
+        / (1 - std::pow(optimizer.beta1, T(t)));
+    }
+    return {s, step};
+  }
+
+  /**
+   * \return the change of element k of a row touched by touch()
+   */
+  T delta(const Optimizer& optimizer, const StateRow& row, size_type k,
+          T grad) const {
+    T* const s = row.s;
+    switch (optimizer.method) {
+      case Adagrad: {
+        const T sum = load(s + k) + grad * grad;
+        store(s + k, sum);
+        return -row.step * grad / (std::sqrt(sum) + optimizer.eps);
+      }
+      case Adam: {
+        const T m = optimizer.beta1 * load(s + k)
+          + (1 - optimizer.beta1) * grad;
+        const T v = optimizer.beta2 * load(s + width_ + k)
+          + (1 - optimizer.beta2) * grad * grad;
+        store(s + k, m);
+        store(s + width_ + k, v);
+        return -row.step * m / (std::sqrt(v) + optimizer.eps);
+      }
+      default:
+        return -row.step * grad;
+    }
+  }
+
+  /**
+   * \brief end of a step, every row touched after it with accumulate is
+   *        one step later
+   */
+  void tick() { ++step_; }
+
+ private:
+  T* row(size_type r) {
+    const size_type p = r / page_rows_;
+    T* page = __atomic_load_n(&pages_[p], __ATOMIC_ACQUIRE);
+    if (page == nullptr) {
+      T* fresh = new T[2 * page_rows_ * width_]();
+      if (__atomic_compare_exchange_n(&pages_[p], &page, fresh, false,
+                                      __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+        page = fresh;
+      } else {
+        delete [] fresh;  // installed by another thread meanwhile
+      }
+    }
+    return page + 2 * (r % page_rows_) * width_;
+  }
+  static T load(const T* p) {
+    T v;
+    __atomic_load(p, &v, __ATOMIC_RELAXED);
+    return v;
+  }
+  static void store(T* p, T v) {
+    __atomic_store(p, &v, __ATOMIC_RELAXED);
+  }
+
+  const size_type    width_;
+  const size_type    page_rows_;  // rows per allocation, about a line
+  vector<T* >        pages_;      // [m, v] of page_rows_ rows each
+  vector<uint32_t >  stamp_;      // Adam step of the last update per row
+  uint32_t           step_ = 0;
+};
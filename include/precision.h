@@ -0,0 +1,131 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <cstdint>
+#include <cstring>
+#include "half.h"
+#include "tensor.h"
+
+/**
+ * \brief storage precision of the parameters, compute stays in fp32
+ */
+enum Precision {
+  FP32, FP16, BF16
+};
+
+/**
+ * \brief IEEE binary16 parameter
+ */
+struct half_t {
+  uint16_t bits;
+};
+
+/**
+ * \brief bfloat16 parameter, the upper half of a binary32
+ */
+struct bfloat16_t {
+  uint16_t bits;
+};
+
+inline float to_float(float w) { return w; }
+inline float to_float(half_t w) { return half_to_float(w.bits); }
+inline float to_float(bfloat16_t w) {
+  const uint32_t x = static_cast<uint32_t>(w.bits) << 16;
+  float f;
+  std::memcpy(&f, &x, sizeof(f));
+  return f;
+}
+
+/**
+ * \brief nonzero xorshift seed of stream `lane` (0 to 16) of the calling
+ *        thread, so the threads draw different rounding decisions
+ */
+inline uint32_t rounding_seed(uint32_t lane) {
+  uint32_t s = 0x9e3779b9u * (17u * omp_get_thread_num() + lane + 1);
+  s ^= s >> 16;
+  s *= 0x85ebca6bu;
+  s ^= s >> 13;
+  return s | 1u;
+}
+
+/**
+ * \brief 32 random bits of the calling thread for stochastic rounding
+ */
+inline uint32_t rounding_bits() {
+  static thread_local uint32_t state = rounding_seed(0);
+  state ^= state << 13;
+  state ^= state >> 17;
+  state ^= state << 5;
+  return state;
+}
+
+/**
+ * \brief round to nearest, for initialization
+ */
+template <typename W>
+W from_float(float f);
+
+template <>
+inline float from_float<float>(float f) { return f; }
+template <>
+inline half_t from_float<half_t>(float f) { return {float_to_half(f)}; }
+template <>
+inline bfloat16_t from_float<bfloat16_t>(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  if ((x & 0x7fffffffu) > 0x7f800000u)  // keep nan quiet
+    return {static_cast<uint16_t>((x >> 16) | 0x40u)};
+  x += 0x7fffu + ((x >> 16) & 1u);
+  return {static_cast<uint16_t>(x >> 16)};
+}
+
+/**
+ * \brief stochastic rounding of an updated parameter: rounds up with
+ *        probability proportional to the distance to the lower value,
+ *        so small updates are not lost to the precision on average
+ */
+template <typename W>
+W round_stochastic(float f);
+
+template <>
+inline float round_stochastic<float>(float f) { return f; }
+
+template <>
+inline bfloat16_t round_stochastic<bfloat16_t>(float f) {
+  uint32_t x;
+  std::memcpy(&x, &f, sizeof(x));
+  if ((x & 0x7f800000u) == 0x7f800000u)  // inf or nan
+    return from_float<bfloat16_t>(f);
+  // carry into the kept bits with probability (dropped bits) / 2^16
+  x += rounding_bits() & 0xffffu;
+  return {static_cast<uint16_t>(x >> 16)};
+}
+
+template <>
+inline half_t round_stochastic<half_t>(float f) {
+  uint16_t h = float_to_half(f);
+  const float nearest = half_to_float(h);
+  if (nearest == f || (h & 0x7c00u) == 0x7c00u)
+    return {h};
+  // the other neighbour of f, one step of the magnitude bits away
+  uint16_t other;
+  if ((h & 0x7fffu) == 0)
+    other = static_cast<uint16_t>((f < 0 ? 0x8000u : 0) | 1u);
+  else
+    other = ((nearest < f) == !(h & 0x8000u)) ? h + 1 : h - 1;
+  const float p = (f - nearest) / (half_to_float(other) - nearest);
+  if ((rounding_bits() >> 8) * (1.f / (1u << 24)) < p)
+    h = other;
+  return {h};
+}
+
+/**
+ * \brief w += delta in the storage precision of w
+ */
+template <typename W>
+inline void add_rounded(W& w, T delta) {
+  w = round_stochastic<W>(to_float(w) + delta);
+}
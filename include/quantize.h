@@ -0,0 +1,153 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <vector>
+#include "precision.h"
+#include "simd.h"
+#include "tensor.h"
+
+using std::vector;
+
+/**
+ * \brief inference copy of a weight matrix of shape [rows, width] in int8,
+ *        with one scale per row: w[r, k] ~ scale[r] * q[r, k]
+ */
+struct Int8Matrix {
+  size_type        rows = 0;
+  size_type        width = 0;
+  vector<int8_t >  q;      // shape of [rows, width]
+  vector<T >       scale;  // shape of [rows]
+
+  bool empty() const { return q.empty(); }
+
+  template <typename W>
+  void build(const W* w, size_type rows_, size_type width_) {
+    rows = rows_;
+    width = width_;
+    q.resize(static_cast<size_t>(rows) * width);
+    scale.resize(rows);
+    for (size_type r = 0; r < rows; ++r) {
+      const W* row = w + static_cast<size_t>(r) * width;
+      T max_abs = 0;
+      for (size_type k = 0; k < width; ++k)
+        max_abs = std::max(max_abs, std::abs(to_float(row[k])));
+      scale[r] = max_abs / 127;
+      const T inverse = max_abs > 0 ? 127 / max_abs : 0;
+      int8_t* qr = &q[static_cast<size_t>(r) * width];
+      for (size_type k = 0; k < width; ++k)
+        qr[k] = static_cast<int8_t>(std::lrint(to_float(row[k]) * inverse));
+    }
+  }
+};
+
+/**
+ * \brief int8 code of v in units of step, clipped to [-127, 127]
+ */
+inline int16_t quantize_int8(T v, T inverse_step) {
+  long q = std::lrint(v * inverse_step);
+  return static_cast<int16_t>(std::max(-127L, std::min(127L, q)));
+}
+
+/**
+ * \brief PQ/RQ lookup tables [M, Ks] in uint8 with one step shared by
+ *        all the subspaces, so the sum over the subspaces of an output
+ *        is an integer: sum_m t[m][c_m] ~ offset + step * sum_m q[m][c_m]
+ */
+template <size_type M, size_type Ks>
+struct QuantizedTables {
+  uint8_t  q[M][Ks];  // followed by offset, so gather_sum may read past it
+  T        offset;    // sum of the minimum of every subspace
+  T        step;
+
+  explicit QuantizedTables(const T (&tables)[M][Ks]) {
+    T low[M];
+    T range = 0;
+    offset = 0;
+    for (int m = 0; m < M; ++m) {
+      low[m] = *std::min_element(tables[m], tables[m] + Ks);
+      range = std::max(range,
+                       *std::max_element(tables[m], tables[m] + Ks) - low[m]);
+      offset += low[m];
+    }
+    step = range / 255;
+    const T inverse = range > 0 ? 255 / range : 0;
+    for (int m = 0; m < M; ++m) {
+      for (int k = 0; k < Ks; ++k) {
+        q[m][k] = static_cast<uint8_t>(
+          std::lrint((tables[m][k] - low[m]) * inverse));
+      }
+    }
+  }
+
+  /**
+   * \return the table sum of the codes of one output, code[m * stride]
+   *         for subspace m (see CodeLayout)
+   */
+  template <typename Code>
+  T sum(const Code* code, size_type stride = 1) const {
+    int32_t s = 0;
+    for (int m = 0; m < M; ++m)
+      s += q[m][code[m * stride]];
+    return offset + step * s;
+  }
+  /**
+   * \brief sum[k] = bias[k] + the table sum of output k, for a block of n
+   *        outputs whose codes in a subspace are contiguous, code[m *
+   *        stride + k] for subspace m (see CodeLayout), as vector gathers
+   */
+  void sum(size_type n, const uint8_t* code, size_type stride,
+           const T* bias, T* sum) const {
+    int32_t s[256];
+    for (size_type begin = 0; begin < n; begin += 256) {
+      const size_type size = std::min<size_type>(256, n - begin);
+      gather_sum(size, M, code + begin, stride, q[0], Ks, s);
+      for (size_type k = 0; k < size; ++k)
+        sum[begin + k] = bias[begin + k] + offset + step * s[k];
+    }
+  }
+};
+
+/**
+ * \brief 4-bit codes [n, m] of a PQ layer with Ks = 16, packed for
+ *        fast_scan_block: blocks of 32 outputs with 16 bytes per subspace,
+ *        byte j holds output j of the block in the low nibble and output
+ *        j + 16 in the high one. The outputs after n are padded with 0
+ */
+struct PackedCodes4 {
+  static constexpr size_type BLOCK = 32;
+  size_type          m = 0;
+  size_type          blocks = 0;
+  vector<uint8_t >   codes;  // shape of [blocks, m, 16]
+
+  bool empty() const { return codes.empty(); }
+  const uint8_t* block(size_type b) const {
+    return &codes[static_cast<size_t>(b) * m * 16];
+  }
+
+  template <typename Code>
+  void build(const Code* code, size_type n, size_type m_) {
+    build(code, n, m_, [m_](size_type o, size_type s) { return o * m_ + s; });
+  }
+  /**
+   * \param slot position of the code of output o in subspace s in code
+   */
+  template <typename Code, typename Slot>
+  void build(const Code* code, size_type n, size_type m_, Slot slot) {
+    m = m_;
+    blocks = (n + BLOCK - 1) / BLOCK;
+    codes.assign(static_cast<size_t>(blocks) * m * 16, 0);
+    for (size_type o = 0; o < n; ++o) {
+      const size_type j = o % BLOCK;
+      uint8_t* packed = &codes[static_cast<size_t>(o / BLOCK) * m * 16];
+      for (size_type s = 0; s < m; ++s) {
+        const uint8_t c = static_cast<uint8_t>(code[slot(o, s)]) & 0x0f;
+        packed[s * 16 + j % 16] |= j < 16 ? c : c << 4;
+      }
+    }
+  }
+};
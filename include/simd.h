@@ -0,0 +1,99 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include "precision.h"
+#include "tensor.h"
+
+/**
+ * \brief instruction sets of the vector kernels, the best one supported
+ *        by the CPU is picked at start up
+ */
+enum SimdLevel {
+  SimdScalar = 0, SimdAVX2 = 1, SimdAVX512 = 2
+};
+
+SimdLevel simd_level();
+/**
+ * \brief use another instruction set, clipped to what the CPU supports
+ * \return the level in use
+ */
+SimdLevel set_simd_level(SimdLevel level);
+
+/**
+ * \brief y[0, n) += a * x[0, n)
+ */
+void axpy(size_type n, T a, const T* x, T* y);
+/**
+ * \return sum of x[k] * y[k] over [0, n)
+ */
+T dot(size_type n, const T* x, const T* y);
+/**
+ * \return sum of value[k] * y[index[k]] over [0, n)
+ */
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const T* y);
+/**
+ * \brief y[index[k]] += a * value[k] over [0, n), the indices are unique
+ */
+void sparse_axpy(size_type n, T a, const size_type* index, const T* value,
+                 T* y);
+
+/**
+ * \brief the kernels over parameters stored in half or bfloat16, the
+ *        parameters are widened to fp32 and accumulated in fp32
+ */
+void axpy(size_type n, T a, const half_t* x, T* y);
+void axpy(size_type n, T a, const bfloat16_t* x, T* y);
+T dot(size_type n, const T* x, const half_t* y);
+T dot(size_type n, const T* x, const bfloat16_t* y);
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const half_t* y);
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const bfloat16_t* y);
+/**
+ * \brief y[0, n) += a * x[0, n), rounded stochastically to the storage
+ *        of y, see round_stochastic
+ */
+void axpy_round(size_type n, T a, const T* x, half_t* y);
+void axpy_round(size_type n, T a, const T* x, bfloat16_t* y);
+
+/**
+ * \brief acc[0, n) += a0 * q0[0, n) + a1 * q1[0, n) in int32, the int8
+ *        rows of two inputs at once (pairs of int16 products)
+ */
+void accumulate_int8(size_type n, int16_t a0, const int8_t* q0,
+                     int16_t a1, const int8_t* q1, int32_t* acc);
+
+/**
+ * \brief sum[j] = sum over the m subspaces s of lut[s][code of output j]
+ *        for the 32 outputs of a block of PackedCodes4, in uint16, the
+ *        uint8 tables lut [m, 16] are looked up in registers (pshufb)
+ */
+void fast_scan_block(size_type m, const uint8_t* codes, const uint8_t* lut,
+                     uint16_t* sum);
+
+/**
+ * \brief sum[k] = bias[k] + sum over the m subspaces s of
+ *        table[s * ks + code[s * stride + k]] over [0, n): the lookups of
+ *        a block of n outputs whose codes in a subspace are contiguous
+ *        (see CodeLayout), as vector gathers
+ */
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const T* table, size_type ks,
+                const T* bias, T* sum);
+/**
+ * \brief the same with every entry weighted by scale[s * stride + k]
+ */
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const T* table, size_type ks,
+                const T* bias, const T* scale, T* sum);
+/**
+ * \brief the same over the uint8 tables of QuantizedTables, in int32
+ *        and without bias. The gathers read up to 3 bytes past the last
+ *        entry of the tables
+ */
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const uint8_t* table, size_type ks,
+                int32_t* sum);
@@ -0,0 +1,264 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+
+#pragma once
+#include <omp.h>
+#include <cmath>
+#include <algorithm>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <stdexcept>
+#include <string>
+#include <vector>
+#include "csr_data.h"
+
+using std::string;
+using std::vector;
+
+/**
+ * \brief hand written parsers over a raw byte buffer, they never allocate,
+ *        return the first unconsumed byte, and return `p` on failure
+ */
+inline bool is_digit(char c) {
+  return static_cast<unsigned char>(c - '0') < 10;
+}
+
+inline const char* parse_int(const char* p, long& v) {
+  const char* begin = p;
+  bool negative = (*p == '-');
+  if (*p == '-' || *p == '+')
+    p++;
+  if (!is_digit(*p))
+    return begin;
+  long r = 0;
+  while (is_digit(*p)) {
+    r = r * 10 + (*(p++) - '0');
+  }
+  v = negative ? -r : r;
+  return p;
+}
+
+inline const char* parse_float(const char* p, T& v) {
+  static const double POW10[] = {
+    1e0, 1e1, 1e2, 1e3, 1e4, 1e5, 1e6, 1e7, 1e8, 1e9, 1e10, 1e11,
+    1e12, 1e13, 1e14, 1e15, 1e16, 1e17, 1e18, 1e19, 1e20, 1e21, 1e22
+  };
+  const uint64_t MAX_MANTISSA = 100000000000000000ULL;
+  const char* begin = p;
+  bool negative = (*p == '-');
+  if (*p == '-' || *p == '+')
+    p++;
+
+  uint64_t mantissa = 0;
+  int exp10 = 0;
+  bool has_digit = false;
+  for (; is_digit(*p); p++, has_digit = true) {
+    if (mantissa < MAX_MANTISSA)
+      mantissa = mantissa * 10 + (*p - '0');
+    else
+      exp10++;
+  }
+  if (*p == '.') {
+    for (p++; is_digit(*p); p++, has_digit = true) {
+      if (mantissa < MAX_MANTISSA) {
+        mantissa = mantissa * 10 + (*p - '0');
+        exp10--;
+      }
+    }
+  }
+  if (!has_digit)
+    return begin;
+  if (*p == 'e' || *p == 'E') {
+    long e;
+    const char* q = parse_int(p + 1, e);
+    if (q != p + 1) {
+      exp10 += static_cast<int>(e);
+      p = q;
+    }
+  }
+
+  double r = static_cast<double>(mantissa);
+  if (exp10 < 0)
+    r = (exp10 >= -22) ? r / POW10[-exp10] : r * std::pow(10.0, exp10);
+  else if (exp10 > 0)
+    r = (exp10 <= 22) ? r * POW10[exp10] : r * std::pow(10.0, exp10);
+  v = static_cast<T>(negative ? -r : r);
+  return p;
+}
+
+/**
+ * \brief parse one record "l1,l2,...,lk f1:v1 f2:v2 ... fd:vd" appending
+ *        it to the batch, negative labels are mapped to 0. The line must
+ *        be terminated by '\n'.
+ * \return the beginning of the next line
+ */
+inline const char* parse_svm_record(const char* p, CSRBatch& batch) {
+  const char* q;
+  long l;
+  while (*p != ' ' && *p != '\t' && *p != '\n') {
+    q = parse_int(p, l);
+    if (q == p)
+      break;
+    batch.label_.push_back(l > 0 ? static_cast<size_type>(l) : 0);
+    p = (*q == ',') ? q + 1 : q;
+  }
+  while (true) {
+    while (*p == ' ' || *p == '\t')
+      p++;
+    long i;
+    T v;
+    q = parse_int(p, i);
+    if (q == p || *q != ':')
+      break;
+    p = parse_float(q + 1, v);
+    if (p == q + 1)
+      break;
+    batch.index_.push_back(static_cast<size_type>(i));
+    batch.value_.push_back(v);
+  }
+  batch.offset_.push_back(batch.index_.size());
+  batch.label_offset_.push_back(batch.label_.size());
+  while (*p != '\n')
+    p++;
+  return p + 1;
+}
+
+/**
+ * \brief block reader of a libsvm/XML text file, records are parsed in
+ *        place from a reused buffer without per line allocation
+ */
+class SVMReader {
+ public:
+  SVMReader(const string& file_name, bool has_header,
+            size_t buffer_size = 1 << 22)
+    : file_(std::fopen(file_name.c_str(), "rb")), buffer_(buffer_size + 1),
+      begin_(0), end_(0), tail_(0), eof_(false),
+      num_items_(0), num_features_(0), num_labels_(0) {
+    if (!file_)
+      throw std::runtime_error("data file not found: " + file_name);
+    if (has_header && fill()) {
+      const char* p = buffer_.data() + begin_;
+      long v;
+      p = parse_int(p, v), num_items_ = v;
+      while (*p == ' ') p++;
+      p = parse_int(p, v), num_features_ = v;
+      while (*p == ' ') p++;
+      p = parse_int(p, v), num_labels_ = v;
+      while (*p != '\n')
+        p++;
+      begin_ = p + 1 - buffer_.data();
+    }
+  }
+  ~SVMReader() {
+    std::fclose(file_);
+  }
+
+  SVMReader(const SVMReader&) = delete;
+  SVMReader& operator=(const SVMReader&) = delete;
+
+  /**
+   * \brief append up to max_rows records to the batch
+   * \return number of records appended, 0 at the end of file
+   */
+  int read(CSRBatch& batch, int max_rows) {
+    int rows = 0;
+    while (rows < max_rows && fill()) {
+      const char* p = buffer_.data() + begin_;
+      const char* end = buffer_.data() + end_;
+      for (; rows < max_rows && p < end; rows++) {
+        p = parse_svm_record(p, batch);
+      }
+      begin_ = p - buffer_.data();
+    }
+    return rows;
+  }
+
+  /**
+   * \brief append every complete record of the next buffer window, the
+   *        window is split at newline aligned offsets into one chunk per
+   *        thread and the chunks are stitched back in file order
+   * \param chunks per thread scratch batches, reused across calls
+   * \param threads number of chunks and threads parsing them
+   * \return number of records appended, 0 at the end of file
+   */
+  int read_parallel(CSRBatch& batch, vector<CSRBatch >& chunks,
+                    int threads = omp_get_max_threads()) {
+    if (!fill())
+      return 0;
+    const int num_chunks = std::max(1, threads);
+    const char* begin = buffer_.data() + begin_;
+    const char* end = buffer_.data() + end_;
+    vector<const char* > bounds(num_chunks + 1, end);
+    bounds[0] = begin;
+    for (int c = 1; c < num_chunks; ++c) {
+      const char* p = std::max(bounds[c-1],
+                               begin + (end - begin) * c / num_chunks);
+      while (p < end && p != begin && p[-1] != '\n')
+        p++;
+      bounds[c] = p;
+    }
+    chunks.resize(num_chunks);
+
+#pragma omp parallel for schedule(static, 1) num_threads(num_chunks)
+    for (int c = 0; c < num_chunks; ++c) {
+      chunks[c].clear();
+      for (const char* p = bounds[c]; p < bounds[c+1]; ) {
+        p = parse_svm_record(p, chunks[c]);
+      }
+    }
+    begin_ = end_;
+
+    return stitch(chunks, batch);
+  }
+
+  long getNumItems() const { return num_items_; }
+  long getNumFeatures() const { return num_features_; }
+  long getNumLabels() const { return num_labels_; }
+
+ private:
+  /**
+   * \brief make sure [begin_, end_) holds at least one complete line
+   *        followed by a '\n' sentinel
+   * \return false if nothing is left
+   */
+  bool fill() {
+    if (begin_ < end_)
+      return true;
+    // move the trailing partial line to the front and read behind it
+    size_t tail = tail_ - end_;
+    std::memmove(buffer_.data(), buffer_.data() + end_, tail);
+    begin_ = end_ = 0;
+    tail_ = tail;
+    while (end_ == 0) {
+      if (eof_) {
+        if (tail_ == 0)
+          return false;
+        buffer_[tail_] = '\n';
+        end_ = tail_ = tail_ + 1;
+        break;
+      }
+      if (tail_ + 1 >= buffer_.size())
+        buffer_.resize(buffer_.size() * 2);
+      size_t n = std::fread(buffer_.data() + tail_, 1,
+                            buffer_.size() - 1 - tail_, file_);
+      eof_ = (n == 0);
+      tail_ += n;
+      const void* last = memrchr(buffer_.data(), '\n', tail_);
+      if (last)
+        end_ = static_cast<const char*>(last) - buffer_.data() + 1;
+    }
+    return true;
+  }
+
+  FILE*         file_;
+  vector<char > buffer_;
+  size_t        begin_;  // first unparsed byte
+  size_t        end_;    // one past the last complete line
+  size_t        tail_;   // one past the last byte read
+  bool          eof_;
+  long          num_items_;
+  long          num_features_;
+  long          num_labels_;
+};
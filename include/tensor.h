@@ -3,23 +3,70 @@
 //
 
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <numeric>
 #include <vector>
+#include "arena.h"
 
 using std::vector;
 using T = float;
 using size_type = int;
 
+struct SparseRow;
+
+/**
+ * \brief a ReLu activation with at least this fraction of positive
+ *        outputs is stored densely
+ */
+const float DENSE_RATIO = 0.5f;
+
+/**
+ * \return the shared array 0, 1, ..., n-1 standing for the indices of a
+ *         dense vector of size n, it is never freed
+ */
+inline const size_type* dense_index(size_type n) {
+  static std::atomic<const size_type* > tables[32];
+  static std::mutex mutex;
+  int level = 0;
+  while ((static_cast<size_t>(1) << level) < static_cast<size_t>(n))
+    level++;
+  const size_type* table = tables[level].load(std::memory_order_acquire);
+  if (!table) {
+    std::lock_guard<std::mutex> lock(mutex);
+    table = tables[level].load(std::memory_order_relaxed);
+    if (!table) {
+      size_type* created = new size_type[static_cast<size_t>(1) << level];
+      std::iota(created, created + (static_cast<size_t>(1) << level), 0);
+      tables[level].store(created, std::memory_order_release);
+      table = created;
+    }
+  }
+  return table;
+}
+
+/**
+ * \brief sparse vector whose storage is borrowed from the thread arena
+ *        inside an ArenaScope (see arena.h), and from the heap otherwise.
+ *        A dense vector keeps every value in value_ and no index_, read
+ *        it through a SparseRow to get the implicit indices.
+ */
 class SparseVector {
  public:
   SparseVector()  = default;
-  SparseVector(vector<size_type >&& idx, vector<T >&& val)
-    : index_(idx), value_(val) {}
+  SparseVector(const vector<size_type >& idx, const vector<T >& val)
+    : index_(idx.begin(), idx.end()), value_(val.begin(), val.end()) {}
   SparseVector(size_type* idx, T* val, int len)
     : index_(idx, idx+len), value_(val, val+len) {}
 
+  SparseVector(const SparseRow& s);
+
   SparseVector(const SparseVector& s) = default;
   SparseVector(SparseVector&& s) = default;
-  SparseVector(const vector<T>& s): index_(s.size()), value_(s) {
+  SparseVector(const vector<T>& s)
+    : index_(s.size()), value_(s.begin(), s.end()) {
     std::iota(index_.begin(), index_.end(), 0);
   }
 
@@ -28,20 +75,35 @@ class SparseVector {
   SparseVector& operator=(const vector<T>& s) {
     index_.resize(s.size());
     std::iota(index_.begin(), index_.end(), 0);
-    value_ = s;
-  }
-  SparseVector& operator=(vector<T >&& s) {
-    index_.resize(s.size());
-    std::iota(index_.begin(), index_.end(), 0);
-    value_ = s;
+    value_.assign(s.begin(), s.end());
+    return *this;
   }
 
   void clear() {
     index_.clear();
     value_.clear();
+    dense_ = false;
   }
   size_t size() const {
-    return index_.size();
+    return value_.size();
+  }
+  bool dense() const {
+    return dense_;
+  }
+  /**
+   * \brief switch to the dense form of dimension `dim`, the missing
+   *        entries become zeros
+   */
+  void densify(size_type dim) {
+    if (dense_)
+      return;
+    ArenaVector<T > value(dim, 0);
+    for (size_t i = 0; i < index_.size(); ++i) {
+      value[index_[i]] = value_[i];
+    }
+    value_.swap(value);
+    index_.clear();
+    dense_ = true;
   }
   void reserve(size_t size) {
     index_.reserve(size);
@@ -51,6 +113,77 @@ class SparseVector {
     index_.push_back(idx);
     value_.push_back(val);
   }
-  vector<size_type > index_;
-  vector<T >         value_;
+  ArenaVector<size_type > index_;
+  ArenaVector<T >         value_;
+  bool                    dense_ = false;
+};
+
+/**
+ * \brief non-owning view over one sparse row, layers read their input
+ *        through it so that records are never copied into a SparseVector.
+ *        The row of a dense vector has dense_ set and index_[i] == i, so
+ *        layers may take a contiguous fast path on it.
+ */
+struct SparseRow {
+  SparseRow() : index_(nullptr), value_(nullptr), size_(0), dense_(false) {}
+  SparseRow(const size_type* idx, const T* val, size_type len)
+    : index_(idx), value_(val), size_(len), dense_(false) {}
+  SparseRow(const SparseVector& s)
+    : index_(s.dense_ ? dense_index(static_cast<size_type>(s.size()))
+                      : s.index_.data()),
+      value_(s.value_.data()), size_(static_cast<size_type>(s.size())),
+      dense_(s.dense_) {}
+
+  size_t size() const {
+    return static_cast<size_t>(size_);
+  }
+  const size_type*  index_;
+  const T*          value_;
+  size_type         size_;
+  bool              dense_;
+};
+
+inline SparseVector::SparseVector(const SparseRow& s)
+  : index_(s.index_, s.index_ + s.size_), value_(s.value_, s.value_ + s.size_) {}
+
+/**
+ * \brief non-owning CSR batch, row r covers index[offset[r], offset[r+1])
+ *        and label[label_offset[r], label_offset[r+1]), offsets are
+ *        relative to the base pointers. If `order` is set, the b-th row
+ *        of the batch is row order[b] of the arrays, so a shuffled batch
+ *        is a view as well.
+ */
+struct SparseBatch {
+  size_type          rows;
+  const uint64_t*    offset;        // shape of [rows + 1] without order
+  const uint64_t*    label_offset;  // shape of [rows + 1] without order
+  const size_type*   index;
+  const T*           value;
+  const size_type*   label;
+  const size_type*   order = nullptr;  // shape of [rows] if set
+
+  size_type at(size_type b) const {
+    return order ? order[b] : b;
+  }
+  SparseRow row(size_type b) const {
+    const size_type r = at(b);
+    return {index + offset[r], value + offset[r],
+            static_cast<size_type>(offset[r+1] - offset[r])};
+  }
+  const size_type* labels(size_type b) const {
+    return label + label_offset[at(b)];
+  }
+  size_type num_labels(size_type b) const {
+    const size_type r = at(b);
+    return static_cast<size_type>(label_offset[r+1] - label_offset[r]);
+  }
+  /**
+   * \brief view over rows [begin, begin + size), clipped to the rows
+   */
+  SparseBatch slice(size_type begin, size_type size) const {
+    size_type n = std::max(0, std::min(size, rows - begin));
+    if (order)
+      return {n, offset, label_offset, index, value, label, order + begin};
+    return {n, offset + begin, label_offset + begin, index, value, label};
+  }
 };
@@ -6,6 +6,7 @@
 
 #include <algorithm>
 #include <functional>
+#include <limits>
 #include <utility>
 #include <vector>
 #include "tensor.h"
@@ -58,7 +59,17 @@ class TopSelector {
     return k_;
   }
 
+  /**
+   * \return the value a candidate has to exceed to be inserted, the
+   *         lowest one until k are kept
+   */
+  V threshold() const {
+    if (heap_.size() < k_)
+      return std::numeric_limits<V>::lowest();
+    return heap_[0].first;
+  }
+
  private:
   ID                   k_;
-  vector<pair<V, ID> > heap_;
+  ArenaVector<pair<V, ID> > heap_;
 };
@@ -20,6 +20,9 @@
 
 size_type vq(const T* w, const T* dict, size_type ks, size_type d);
 size_type nvq(T* norm, T* w, const T* dict, size_type ks, size_type d);
+size_type vq_transposed(const T* w, const T* dict, size_type ks, size_type d);
+size_type nvq_transposed(T* norm, T* w, const T* dict,
+                         size_type ks, size_type d);
 void rq(const T* w, const T* dict, CodeType* code, T* norm,
         size_type ks, size_type m, size_type d);
 
@@ -29,6 +32,8 @@ T normalize(T* w, size_type d);
 T l2dist_sqr(const T *a, const T *b, size_type d);
 
 void normalize_codebook(T* dict, size_type m, size_type ks, size_type d);
+void transpose_codebook(T* dict_t, const T* dict,
+                        size_type m, size_type ks, size_type d);
 
 void kmeans(T* centroids, CodeType* code, const T* data,
             size_type n, size_type ks, size_type d, size_type iter);
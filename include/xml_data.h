@@ -5,100 +5,179 @@
 #ifndef VQ_LAYER__XML_DATA_H_
 #define VQ_LAYER__XML_DATA_H_
 
+#include <algorithm>
+#include <condition_variable>
 #include <thread>
+#include <mutex>
 #include <deque>
+#include <memory>
 #include <vector>
-#include <fstream>
-#include <iostream>
-#include <sstream>
 #include <string>
-#include <string.h>
 
-using std::stoi;
-using std::stof;
+#include "compressed_data.h"
+#include "feature_map.h"
+#include "svm_parser.h"
+
 using std::vector;
 using std::string;
-using std::ofstream;
-using std::ifstream;
-using std::istringstream;
 
+/**
+ * \brief libsvm/XML text or compressed dataset reader with a background
+ *        producer thread that decodes up to `capacity` batches ahead of
+ *        the consumer. The file is read window by window with a few
+ *        OpenMP threads, as the training loop runs its own team meanwhile,
+ *        and the batches are sliced out of the current window.
+ */
 class SparseData {
  public:
-  SparseData(const string& file_name, const int batch_size)
-  : data_reader_(file_name), batch_size_(batch_size) {
-    string line;
-    std::getline(data_reader_,  line);
-    istringstream iss(line);
-    iss >> num_items_ >> num_features_ >> num_labels_;
-
-    std::thread([this](){
+  /**
+   * \param file_name   text dataset, or a compressed one (see
+   *                    convert_svm_to_compressed) detected by its magic
+   * \param batch_size  records per batch
+   * \param has_header  whether the first line is "Total Features Labels"
+   * \param max_batches stop after this many batches, -1 for the whole file
+   * \param capacity    number of batches parsed ahead
+   * \param window      bytes of text parsed in parallel at once
+   * \param feature_map if given, remaps the feature ids of every batch
+   * \param threads     OpenMP threads parsing and remapping a window
+   */
+  SparseData(const string& file_name, const int batch_size,
+             const bool has_header = true, const int max_batches = -1,
+             const int capacity = 2, const size_t window = 1 << 24,
+             const FeatureMap* feature_map = nullptr,
+             const int threads = 2)
+  : batch_size_(batch_size),
+    max_batches_(max_batches), threads_(threads), feature_map_(feature_map),
+    window_row_(0), slots_(capacity + 1),
+    stop_(false), done_(false), current_(nullptr) {
+    if (is_compressed(file_name))
+      compressed_reader_.reset(new CompressedReader(file_name));
+    else
+      data_reader_.reset(new SVMReader(file_name, has_header, window));
+    window_.clear();
+    // one slot is held by the consumer, the others are filled ahead
+    for (auto& slot : slots_) {
+      free_.push_back(&slot);
+    }
+    loader_ = std::thread([this](){
         loadData();
     });
   }
 
   ~SparseData() {
-    data_reader_.close();
+    {
+      std::lock_guard<std::mutex> lock(mutex_);
+      stop_ = true;
+    }
+    cond_.notify_all();
+    loader_.join();
   }
 
-  void nextBatch(const int batch_size) {
-    // TODO
+  /**
+   * \brief blocks until the next batch is parsed, the view stays valid
+   *        until the following call
+   * \return false when the file or max_batches is exhausted
+   */
+  bool nextBatch(CSRView& view) {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (current_) {
+      free_.push_back(current_);
+      current_ = nullptr;
+      cond_.notify_all();
+    }
+    cond_.wait(lock, [this]() { return !full_.empty() || done_; });
+    if (full_.empty())
+      return false;
+    current_ = full_.front();
+    full_.pop_front();
+    view = current_->view();
+    return true;
   }
   int getBatchSize() const {
     return batch_size_;
   }
   int getNumItems() const {
-    return num_items_;
+    return data_reader_ ? data_reader_->getNumItems()
+                        : compressed_reader_->header().num_rows;
   }
   int getNumFeatures() const {
-    return num_features_;
+    return data_reader_ ? data_reader_->getNumFeatures()
+                        : compressed_reader_->header().num_features;
   }
   int getNumLabels() const {
-    return num_labels_;
+    return data_reader_ ? data_reader_->getNumLabels()
+                        : compressed_reader_->header().num_labels;
   }
  private:
-  void loadData() {
-
+  int readWindow() {
+    return data_reader_
+      ? data_reader_->read_parallel(window_, chunks_, threads_)
+      : compressed_reader_->read_parallel(window_, chunks_, threads_);
   }
 
-  void loadLine() {
-    string str;
-    if (std::getline(data_reader_, str)) {
-      char *mystring = &str[0];
-      char *pch, *pchlabel;
-      int track = 0;
-      index_.clear();
-      value_.clear();
-      label_.clear();
-      pch = strtok(mystring, " ");
-      pch = strtok(NULL, " :");
-      while (pch != NULL) {
-        if (track % 2 == 0)
-          index_.push_back(stoi(pch));
-        else if (track%2==1)
-          value_.push_back(stof(pch));
-        track++;
-        pch = strtok(NULL, " :");
+  void loadData() {
+    for (int b = 0; max_batches_ < 0 || b < max_batches_; ++b) {
+      CSRBatch* batch;
+      {
+        std::unique_lock<std::mutex> lock(mutex_);
+        cond_.wait(lock, [this]() { return !free_.empty() || stop_; });
+        if (stop_)
+          break;
+        batch = free_.front();
+        free_.pop_front();
       }
 
-      pchlabel = strtok(mystring, ",");
-      while (pchlabel != NULL) {
-        label_.push_back(stoi(pchlabel));
-        pchlabel = strtok(NULL, ",");
+      batch->clear();
+      while (batch->rows() < batch_size_) {
+        if (window_row_ == window_.rows()) {
+          window_.clear();
+          window_row_ = 0;
+          if (readWindow() == 0)
+            break;
+        }
+        size_type end = std::min(window_.rows(),
+                                 window_row_ + batch_size_ - batch->rows());
+        batch->append(window_.view(), window_row_, end);
+        window_row_ = end;
       }
+      if (feature_map_)
+        feature_map_->apply(*batch, threads_);
+
+      std::lock_guard<std::mutex> lock(mutex_);
+      if (batch->rows() == 0) {
+        free_.push_back(batch);
+        break;
+      }
+      full_.push_back(batch);
+      cond_.notify_all();
     }
+    std::lock_guard<std::mutex> lock(mutex_);
+    done_ = true;
+    cond_.notify_all();
   }
 
  private:
-  ifstream data_reader_;
-  vector<int > label_;
-  vector<int > index_;
-  vector<float > value_;
+  std::unique_ptr<SVMReader >         data_reader_;
+  std::unique_ptr<CompressedReader >  compressed_reader_;
   int batch_size_;
-  int num_items_;
-  int num_features_;
-  int num_labels_;
+  int max_batches_;
+  int threads_;
+  const FeatureMap*     feature_map_;
+  CSRBatch              window_;
+  vector<CSRBatch >     chunks_;
+  size_type             window_row_;
+
+  vector<CSRBatch >        slots_;
+  std::deque<CSRBatch* >   free_;
+  std::deque<CSRBatch* >   full_;
+  std::mutex               mutex_;
+  std::condition_variable  cond_;
+  std::thread              loader_;
+  bool                     stop_;
+  bool                     done_;
+  CSRBatch*                current_;
 };
 
 
 
-#endif //VQ_LAYER__XML_DATA_H_
\ No newline at end of file
+#endif //VQ_LAYER__XML_DATA_H_
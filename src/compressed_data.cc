@@ -0,0 +1,275 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <fcntl.h>
+#include <omp.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <stdexcept>
+#include "../include/compressed_data.h"
+#include "../include/half.h"
+#include "../include/progress_bar.h"
+#include "../include/svm_parser.h"
+
+const size_t BLOCK_HEADER = 2 * sizeof(uint32_t) + sizeof(uint8_t);
+
+inline void put_varint(uint64_t v, vector<uint8_t >& out) {
+  while (v >= 0x80) {
+    out.push_back(static_cast<uint8_t>(v | 0x80));
+    v >>= 7;
+  }
+  out.push_back(static_cast<uint8_t>(v));
+}
+
+inline const uint8_t* get_varint(const uint8_t* p, uint64_t& v) {
+  uint64_t r = *p & 0x7f;
+  for (int shift = 7; *(p++) & 0x80; shift += 7) {
+    r |= static_cast<uint64_t>(*p & 0x7f) << shift;
+  }
+  v = r;
+  return p;
+}
+
+inline uint64_t zigzag(int64_t v) {
+  return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+inline int64_t unzigzag(uint64_t v) {
+  return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+bool is_compressed(const string& file) {
+  std::ifstream in(file, std::ios::binary);
+  uint64_t magic = 0;
+  in.read(reinterpret_cast<char*>(&magic), sizeof(magic));
+  return in && magic == COMPRESSED_MAGIC;
+}
+
+void encode_block(const CSRView& data, size_type begin, size_type end,
+                  const bool half_values, vector<uint8_t >& block) {
+  const uint64_t first = data.offset[begin], last = data.offset[end];
+  uint8_t coding = ValueOnes;
+  for (uint64_t i = first; i < last; ++i) {
+    if (data.value[i] != 1.0f) {
+      coding = half_values ? ValueHalf : ValueFloat;
+      break;
+    }
+  }
+
+  block.assign(BLOCK_HEADER, 0);
+  for (size_type r = begin; r < end; ++r) {
+    const uint64_t l0 = data.label_offset[r], l1 = data.label_offset[r+1];
+    put_varint(data.offset[r+1] - data.offset[r], block);
+    put_varint(l1 - l0, block);
+    for (uint64_t l = l0; l < l1; ++l) {
+      put_varint(static_cast<uint32_t>(data.label[l]), block);
+    }
+    // indices are usually sorted, zigzag keeps unsorted rows valid
+    int64_t previous = 0;
+    for (uint64_t i = data.offset[r]; i < data.offset[r+1]; ++i) {
+      put_varint(zigzag(data.index[i] - previous), block);
+      previous = data.index[i];
+    }
+  }
+  uint32_t rows = static_cast<uint32_t>(end - begin);
+  uint32_t varint_bytes = static_cast<uint32_t>(block.size() - BLOCK_HEADER);
+  std::memcpy(&block[0], &rows, sizeof(uint32_t));
+  std::memcpy(&block[4], &varint_bytes, sizeof(uint32_t));
+  block[8] = coding;
+
+  if (coding == ValueHalf) {
+    for (uint64_t i = first; i < last; ++i) {
+      uint16_t h = float_to_half(data.value[i]);
+      block.push_back(static_cast<uint8_t>(h));
+      block.push_back(static_cast<uint8_t>(h >> 8));
+    }
+  } else if (coding == ValueFloat) {
+    size_t size = block.size();
+    block.resize(size + (last - first) * sizeof(T));
+    std::memcpy(&block[size], data.value + first, (last - first) * sizeof(T));
+  }
+}
+
+size_t decode_block(const uint8_t* block, CSRBatch& batch) {
+  uint32_t rows, varint_bytes;
+  std::memcpy(&rows, block, sizeof(uint32_t));
+  std::memcpy(&varint_bytes, block + 4, sizeof(uint32_t));
+  const uint8_t coding = block[8];
+  const uint8_t* p = block + BLOCK_HEADER;
+
+  const size_t first = batch.index_.size();
+  uint64_t nnz = first, entries = batch.label_.size();
+  for (uint32_t r = 0; r < rows; ++r) {
+    uint64_t length, num_labels, v;
+    p = get_varint(p, length);
+    p = get_varint(p, num_labels);
+    for (uint64_t l = 0; l < num_labels; ++l) {
+      p = get_varint(p, v);
+      batch.label_.push_back(static_cast<size_type>(v));
+    }
+    int64_t previous = 0;
+    for (uint64_t i = 0; i < length; ++i) {
+      p = get_varint(p, v);
+      previous += unzigzag(v);
+      batch.index_.push_back(static_cast<size_type>(previous));
+    }
+    nnz += length;
+    entries += num_labels;
+    batch.offset_.push_back(nnz);
+    batch.label_offset_.push_back(entries);
+  }
+
+  const size_t count = nnz - first;
+  batch.value_.resize(nnz);
+  T* value = batch.value_.data() + first;
+  if (coding == ValueOnes) {
+    std::fill(value, value + count, 1.0f);
+  } else if (coding == ValueHalf) {
+    for (size_t i = 0; i < count; ++i, p += 2) {
+      value[i] = half_to_float(static_cast<uint16_t>(p[0] | (p[1] << 8)));
+    }
+  } else {
+    std::memcpy(value, p, count * sizeof(T));
+    p += count * sizeof(T);
+  }
+  return p - block;
+}
+
+void convert_svm_to_compressed(const string& svm_file,
+                               const string& compressed_file,
+                               const bool has_header, const bool half_values,
+                               const size_type block_rows) {
+  SVMReader reader(svm_file, has_header, 1 << 26);
+  CompressedHeader header = {COMPRESSED_MAGIC, 0, 0, 0, 0,
+                             static_cast<uint64_t>(block_rows), 0,
+                             static_cast<uint64_t>(reader.getNumFeatures()),
+                             static_cast<uint64_t>(reader.getNumLabels()),
+                             static_cast<uint64_t>(half_values)};
+  std::ofstream out(compressed_file, std::ios::binary);
+  if (!out)
+    throw std::runtime_error("cannot create compressed file: " +
+                             compressed_file);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+
+  vector<uint64_t > block_offset(1, sizeof(header));
+  vector<vector<uint8_t > > blocks;
+  vector<CSRBatch > chunks;
+  CSRBatch pending, rest;
+  pending.clear();
+  ProgressBar progress_bar(reader.getNumItems(), "Compressing " + svm_file);
+
+  bool eof = false;
+  while (!eof) {
+    eof = reader.read_parallel(pending, chunks) == 0;
+    // encode every full block, and the last partial one at the end
+    const CSRView view = pending.view();
+    size_type num_blocks = eof ? (view.rows + block_rows - 1) / block_rows
+                               : view.rows / block_rows;
+    if (blocks.size() < num_blocks)
+      blocks.resize(num_blocks);
+#pragma omp parallel for schedule(dynamic, 1)
+    for (size_type b = 0; b < num_blocks; ++b) {
+      encode_block(view, b * block_rows,
+                   std::min(view.rows, (b + 1) * block_rows),
+                   half_values, blocks[b]);
+    }
+    for (size_type b = 0; b < num_blocks; ++b) {
+      out.write(reinterpret_cast<const char*>(blocks[b].data()),
+                blocks[b].size());
+      block_offset.push_back(block_offset.back() + blocks[b].size());
+    }
+    size_type done = std::min(view.rows, num_blocks * block_rows);
+    header.num_blocks += num_blocks;
+    header.num_rows += done;
+    header.nnz += view.offset[done];
+    header.num_entries += view.label_offset[done];
+    progress_bar += done;
+
+    rest.clear();
+    rest.append(view, done, view.rows);
+    std::swap(pending, rest);
+  }
+
+  header.index_offset = block_offset.back();
+  out.write(reinterpret_cast<const char*>(block_offset.data()),
+            block_offset.size() * sizeof(uint64_t));
+  out.seekp(0);
+  out.write(reinterpret_cast<const char*>(&header), sizeof(header));
+  if (!out)
+    throw std::runtime_error("failed to write compressed file: " +
+                             compressed_file);
+}
+
+CompressedReader::CompressedReader(const string& compressed_file)
+  : next_block_(0) {
+  int fd = open(compressed_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("compressed file not found: " + compressed_file);
+  struct stat st;
+  fstat(fd, &st);
+  length_ = static_cast<size_t>(st.st_size);
+  if (length_ < sizeof(CompressedHeader)) {
+    close(fd);
+    throw std::runtime_error("truncated compressed file: " + compressed_file);
+  }
+  addr_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr_ == MAP_FAILED)
+    throw std::runtime_error("cannot mmap compressed file: " +
+                             compressed_file);
+
+  const char* base = static_cast<const char*>(addr_);
+  header_ = reinterpret_cast<const CompressedHeader*>(base);
+  if (header_->magic != COMPRESSED_MAGIC ||
+      header_->index_offset + (header_->num_blocks + 1) * sizeof(uint64_t)
+        != length_) {
+    munmap(addr_, length_);
+    throw std::runtime_error("corrupted compressed file: " + compressed_file);
+  }
+  block_offset_ = reinterpret_cast<const uint64_t*>(
+    base + header_->index_offset);
+  madvise(addr_, length_, MADV_SEQUENTIAL);
+}
+
+CompressedReader::~CompressedReader() {
+  munmap(addr_, length_);
+}
+
+int CompressedReader::read(CSRBatch& batch) {
+  if (next_block_ == header_->num_blocks)
+    return 0;
+  const uint8_t* base = static_cast<const uint8_t*>(addr_);
+  size_type rows = batch.rows();
+  decode_block(base + block_offset_[next_block_++], batch);
+  return batch.rows() - rows;
+}
+
+int CompressedReader::read_parallel(CSRBatch& batch,
+                                    vector<CSRBatch >& chunks,
+                                    const int threads) {
+  const uint64_t num_chunks = std::min<uint64_t>(
+    std::max(1, threads), header_->num_blocks - next_block_);
+  if (num_chunks == 0)
+    return 0;
+  const uint8_t* base = static_cast<const uint8_t*>(addr_);
+  chunks.resize(num_chunks);
+
+#pragma omp parallel for schedule(static, 1) num_threads(num_chunks)
+  for (int c = 0; c < num_chunks; ++c) {
+    chunks[c].clear();
+    decode_block(base + block_offset_[next_block_ + c], chunks[c]);
+  }
+  next_block_ += num_chunks;
+  return stitch(chunks, batch);
+}
+
+void load_compressed(const string& compressed_file, CSRBatch& data) {
+  CompressedReader reader(compressed_file);
+  vector<CSRBatch > chunks;
+  data.clear();
+  while (reader.read_parallel(data, chunks) > 0) {}
+}
@@ -0,0 +1,214 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <stdexcept>
+#include "../include/csr_data.h"
+#include "../include/svm_parser.h"
+#include "../include/progress_bar.h"
+
+/**
+ * \brief buffered writer of one section of the output file
+ */
+class SectionWriter {
+ public:
+  SectionWriter(int fd, off_t offset) : fd_(fd), offset_(offset) {
+    buffer_.reserve(CAPACITY);
+  }
+  ~SectionWriter() {
+    flush();
+  }
+
+  template <typename V>
+  void append(const V* p, size_t n) {
+    const char* bytes = reinterpret_cast<const char*>(p);
+    size_t len = n * sizeof(V);
+    if (buffer_.size() + len > CAPACITY)
+      flush();
+    buffer_.insert(buffer_.end(), bytes, bytes + len);
+  }
+
+  void flush() {
+    size_t written = 0;
+    while (written < buffer_.size()) {
+      ssize_t w = pwrite(fd_, buffer_.data() + written,
+                         buffer_.size() - written, offset_);
+      if (w <= 0)
+        throw std::runtime_error("failed to write csr file");
+      written += w;
+      offset_ += w;
+    }
+    buffer_.clear();
+  }
+
+ private:
+  static const size_t CAPACITY = 1 << 24;
+  int           fd_;
+  off_t         offset_;
+  vector<char > buffer_;
+};
+
+void convert_svm_to_csr(const string& svm_file, const string& csr_file,
+                        const bool has_header) {
+  const size_t WINDOW = 1 << 26;
+  CSRHeader header = {CSR_MAGIC, 0, 0, 0, 0, 0};
+  CSRBatch batch;
+  vector<CSRBatch > chunks;
+
+  // first pass: count records, non-zeros and labels to lay out the sections
+  {
+    SVMReader reader(svm_file, has_header, WINDOW);
+    header.num_features = reader.getNumFeatures();
+    header.num_labels = reader.getNumLabels();
+    for (batch.clear(); reader.read_parallel(batch, chunks) > 0;
+         batch.clear()) {
+      header.num_rows += batch.rows();
+      header.nnz += batch.index_.size();
+      header.num_entries += batch.label_.size();
+    }
+  }
+
+  int fd = open(csr_file.c_str(), O_CREAT | O_TRUNC | O_WRONLY, 0644);
+  if (fd < 0)
+    throw std::runtime_error("cannot create csr file: " + csr_file);
+
+  const uint64_t n = header.num_rows;
+  off_t offset_pos = sizeof(CSRHeader);
+  off_t label_offset_pos = offset_pos + (n + 1) * sizeof(uint64_t);
+  off_t index_pos = label_offset_pos + (n + 1) * sizeof(uint64_t);
+  off_t value_pos = index_pos + header.nnz * sizeof(size_type);
+  off_t label_pos = value_pos + header.nnz * sizeof(T);
+
+  // second pass: stream every window of records into its sections
+  {
+    SectionWriter offsets(fd, offset_pos);
+    SectionWriter label_offsets(fd, label_offset_pos);
+    SectionWriter indices(fd, index_pos);
+    SectionWriter values(fd, value_pos);
+    SectionWriter labels(fd, label_pos);
+
+    SVMReader reader(svm_file, has_header, WINDOW);
+    ProgressBar progress_bar(n, "Converting " + svm_file);
+    uint64_t nnz = 0, entries = 0;
+    offsets.append(&nnz, 1);
+    label_offsets.append(&entries, 1);
+    for (batch.clear(); reader.read_parallel(batch, chunks) > 0;
+         batch.clear()) {
+      for (int r = 1; r <= batch.rows(); ++r) {
+        uint64_t offset = nnz + batch.offset_[r];
+        uint64_t label_offset = entries + batch.label_offset_[r];
+        offsets.append(&offset, 1);
+        label_offsets.append(&label_offset, 1);
+      }
+      nnz += batch.index_.size();
+      entries += batch.label_.size();
+      indices.append(batch.index_.data(), batch.index_.size());
+      values.append(batch.value_.data(), batch.value_.size());
+      labels.append(batch.label_.data(), batch.label_.size());
+      progress_bar += batch.rows();
+    }
+  }
+  if (pwrite(fd, &header, sizeof(CSRHeader), 0) != sizeof(CSRHeader))
+    throw std::runtime_error("failed to write csr file");
+  close(fd);
+}
+
+int stitch(const vector<CSRBatch >& chunks, CSRBatch& batch) {
+  const int num_chunks = static_cast<int>(chunks.size());
+  vector<size_t > rows(num_chunks + 1, batch.rows());
+  vector<size_t > nnz(num_chunks + 1, batch.index_.size());
+  vector<size_t > entries(num_chunks + 1, batch.label_.size());
+  for (int c = 0; c < num_chunks; ++c) {
+    rows[c+1] = rows[c] + chunks[c].rows();
+    nnz[c+1] = nnz[c] + chunks[c].index_.size();
+    entries[c+1] = entries[c] + chunks[c].label_.size();
+  }
+  batch.offset_.resize(rows[num_chunks] + 1);
+  batch.label_offset_.resize(rows[num_chunks] + 1);
+  batch.index_.resize(nnz[num_chunks]);
+  batch.value_.resize(nnz[num_chunks]);
+  batch.label_.resize(entries[num_chunks]);
+
+#pragma omp parallel for schedule(static, 1) num_threads(std::max(1, num_chunks))
+  for (int c = 0; c < num_chunks; ++c) {
+    const CSRBatch& chunk = chunks[c];
+    for (size_type r = 1; r <= chunk.rows(); ++r) {
+      batch.offset_[rows[c] + r] = nnz[c] + chunk.offset_[r];
+      batch.label_offset_[rows[c] + r] =
+        entries[c] + chunk.label_offset_[r];
+    }
+    std::copy(chunk.index_.begin(), chunk.index_.end(),
+              batch.index_.begin() + nnz[c]);
+    std::copy(chunk.value_.begin(), chunk.value_.end(),
+              batch.value_.begin() + nnz[c]);
+    std::copy(chunk.label_.begin(), chunk.label_.end(),
+              batch.label_.begin() + entries[c]);
+  }
+  return static_cast<int>(rows[num_chunks] - rows[0]);
+}
+
+void load_svm(const string& svm_file, const bool has_header,
+              CSRBatch& data) {
+  SVMReader reader(svm_file, has_header, 1 << 26);
+  vector<CSRBatch > chunks;
+  data.clear();
+  while (reader.read_parallel(data, chunks) > 0) {}
+  data.offset_.shrink_to_fit();
+  data.label_offset_.shrink_to_fit();
+  data.index_.shrink_to_fit();
+  data.value_.shrink_to_fit();
+  data.label_.shrink_to_fit();
+}
+
+MappedCSR::MappedCSR(const string& csr_file) {
+  int fd = open(csr_file.c_str(), O_RDONLY);
+  if (fd < 0)
+    throw std::runtime_error("csr file not found: " + csr_file);
+  struct stat st;
+  fstat(fd, &st);
+  length_ = static_cast<size_t>(st.st_size);
+  if (length_ < sizeof(CSRHeader)) {
+    close(fd);
+    throw std::runtime_error("truncated csr file: " + csr_file);
+  }
+  addr_ = mmap(nullptr, length_, PROT_READ, MAP_SHARED, fd, 0);
+  close(fd);
+  if (addr_ == MAP_FAILED)
+    throw std::runtime_error("cannot mmap csr file: " + csr_file);
+
+  const char* base = static_cast<const char*>(addr_);
+  header_ = reinterpret_cast<const CSRHeader*>(base);
+  const uint64_t n = header_->num_rows;
+  size_t expected = sizeof(CSRHeader) + 2 * (n + 1) * sizeof(uint64_t) +
+    header_->nnz * (sizeof(size_type) + sizeof(T)) +
+    header_->num_entries * sizeof(size_type);
+  if (header_->magic != CSR_MAGIC || expected != length_) {
+    munmap(addr_, length_);
+    throw std::runtime_error("corrupted csr file: " + csr_file);
+  }
+
+  base += sizeof(CSRHeader);
+  offset_ = reinterpret_cast<const uint64_t*>(base);
+  base += (n + 1) * sizeof(uint64_t);
+  label_offset_ = reinterpret_cast<const uint64_t*>(base);
+  base += (n + 1) * sizeof(uint64_t);
+  index_ = reinterpret_cast<const size_type*>(base);
+  base += header_->nnz * sizeof(size_type);
+  value_ = reinterpret_cast<const T*>(base);
+  base += header_->nnz * sizeof(T);
+  label_ = reinterpret_cast<const size_type*>(base);
+
+  // batches are consumed front to back
+  madvise(addr_, length_, MADV_SEQUENTIAL);
+}
+
+MappedCSR::~MappedCSR() {
+  munmap(addr_, length_);
+}
@@ -0,0 +1,145 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <numeric>
+#include <stdexcept>
+#include <utility>
+#include "../include/feature_map.h"
+#include "../include/svm_parser.h"
+
+const uint64_t FEATURE_MAP_MAGIC = 0x31304d4146515600ULL;  // "\0VQFAM01"
+
+void FeatureMap::count(const CSRView& data) {
+  if (counts_.empty())
+    counts_.assign(num_features_, 0);
+  const size_t nnz = data.offset[data.rows] - data.offset[0];
+  const size_type* index = data.index + data.offset[0];
+  uint32_t* counts = counts_.data();
+#pragma omp parallel for
+  for (size_t i = 0; i < nnz; ++i) {
+    size_type id = index[i];
+    if (id >= 0 && id < num_features_) {
+#pragma omp atomic
+      counts[id]++;
+    }
+  }
+}
+
+void FeatureMap::count(const string& svm_file, const bool has_header) {
+  SVMReader reader(svm_file, has_header, 1 << 26);
+  CSRBatch window;
+  vector<CSRBatch > chunks;
+  for (window.clear(); reader.read_parallel(window, chunks) > 0;
+       window.clear()) {
+    count(window.view());
+  }
+}
+
+void FeatureMap::build(const int min_count) {
+  if (counts_.empty())
+    counts_.assign(num_features_, 0);
+  min_count_ = min_count;
+  features_.clear();
+  for (size_type id = 0; id < num_features_; ++id) {
+    if (counts_[id] > 0 && counts_[id] >= min_count)
+      features_.push_back(id);
+  }
+  // most frequent first, ties broken by raw id to stay deterministic
+  std::stable_sort(features_.begin(), features_.end(),
+                   [this](size_type a, size_type b) {
+                     return counts_[a] > counts_[b];
+                   });
+  size_ = static_cast<size_type>(features_.size());
+  map_.assign(num_features_, -1);
+  for (size_type d = 0; d < size_; ++d) {
+    map_[features_[d]] = d;
+  }
+  vector<uint32_t >().swap(counts_);
+}
+
+bool FeatureMap::load(const string& file, const int min_count) {
+  std::ifstream in(file, std::ios::binary);
+  if (!in)
+    return false;
+  uint64_t header[4];
+  in.read(reinterpret_cast<char*>(header), sizeof(header));
+  if (!in || header[0] != FEATURE_MAP_MAGIC ||
+      header[1] != static_cast<uint64_t>(min_count) ||
+      header[2] != static_cast<uint64_t>(num_features_))
+    return false;
+  vector<size_type > features(header[3]);
+  in.read(reinterpret_cast<char*>(features.data()),
+          features.size() * sizeof(size_type));
+  if (!in)
+    return false;
+
+  min_count_ = min_count;
+  features_.swap(features);
+  size_ = static_cast<size_type>(features_.size());
+  map_.assign(num_features_, -1);
+  for (size_type d = 0; d < size_; ++d) {
+    map_[features_[d]] = d;
+  }
+  return true;
+}
+
+void FeatureMap::save(const string& file) const {
+  std::ofstream out(file, std::ios::binary);
+  uint64_t header[4] = {FEATURE_MAP_MAGIC, static_cast<uint64_t>(min_count_),
+                        static_cast<uint64_t>(num_features_),
+                        static_cast<uint64_t>(size_)};
+  out.write(reinterpret_cast<const char*>(header), sizeof(header));
+  out.write(reinterpret_cast<const char*>(features_.data()),
+            features_.size() * sizeof(size_type));
+  if (!out)
+    throw std::runtime_error("failed to write feature map: " + file);
+}
+
+void FeatureMap::apply(CSRBatch& data, int threads) const {
+  const size_type rows = data.rows();
+  vector<uint64_t > length(rows);
+
+  // remap and sort every row inside its own range
+#pragma omp parallel num_threads(std::max(1, threads)) if (rows > 4096)
+  {
+    vector<std::pair<size_type, T> > row;
+#pragma omp for schedule(dynamic, 256)
+    for (size_type r = 0; r < rows; ++r) {
+      row.clear();
+      for (uint64_t i = data.offset_[r]; i < data.offset_[r+1]; ++i) {
+        size_type id = (*this)[data.index_[i]];
+        if (id >= 0)
+          row.emplace_back(id, data.value_[i]);
+      }
+      std::sort(row.begin(), row.end());
+      uint64_t i = data.offset_[r];
+      for (auto& feature : row) {
+        data.index_[i] = feature.first;
+        data.value_[i] = feature.second;
+        i++;
+      }
+      length[r] = row.size();
+    }
+  }
+
+  // compact the rows front to back, a row never moves forward
+  uint64_t nnz = data.offset_[0];
+  for (size_type r = 0; r < rows; ++r) {
+    uint64_t begin = data.offset_[r];
+    if (begin != nnz && length[r] > 0) {
+      std::memmove(&data.index_[nnz], &data.index_[begin],
+                   length[r] * sizeof(size_type));
+      std::memmove(&data.value_[nnz], &data.value_[begin],
+                   length[r] * sizeof(T));
+    }
+    data.offset_[r] = nnz;
+    nnz += length[r];
+  }
+  data.offset_[rows] = nnz;
+  data.index_.resize(nnz);
+  data.value_.resize(nnz);
+}
@@ -14,21 +14,21 @@
 
 
 SparseVector SoftMaxCrossEntropy:: compute(
-    const SparseVector& p,
-    const vector<size_type >& y, T* loss) {
+    const SparseVector& p, const size_type* y,
+    size_type num_labels, T* loss) {
 
 
   SparseVector grad;
-  size_t reserve_size = std::max(p.size(), y.size());
+  size_t reserve_size = std::max(p.size(), (size_t)num_labels);
   grad.reserve(reserve_size);
 
-  T y_prob = (T)1.0 / y.size();
+  T y_prob = (T)1.0 / num_labels;
 
   if (loss) {  // compute loss = Sum(yi log pi)
     T loss_ = 0;
     size_type i_p = 0;
     size_type i_y = 0;
-    while (i_p < p.size() && i_y < y.size()) {
+    while (i_p < p.size() && i_y < num_labels) {
       if (p.index_[i_p] == y[i_y]) {
         loss_ += y_prob * std::log(p.value_[i_p]);
         i_p++, i_y++;
@@ -44,7 +44,7 @@ SparseVector SoftMaxCrossEntropy:: compute(
   size_type i_p = 0;
   size_type i_y = 0;
   // compute gradient : g_i = p_i - y_i
-  while (i_p < p.size() && i_y < y.size()) {
+  while (i_p < p.size() && i_y < num_labels) {
     if (p.index_[i_p] == y[i_y]) {
       grad.push_back(y[i_y], p.value_[i_p] - y_prob);
       i_p++, i_y++;
@@ -60,7 +60,7 @@ SparseVector SoftMaxCrossEntropy:: compute(
     grad.push_back(p.index_[i_p], p.value_[i_p]);
     i_p++;
   }
-  while (i_y < y.size()) {
+  while (i_y < num_labels) {
     grad.push_back(y[i_y], - y_prob);
     i_y++;
   }
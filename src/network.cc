@@ -3,14 +3,39 @@
 #include <limits>
 #include <iostream>
 #include <algorithm>
+#include <stdexcept>
 #include "../include/network.h"
 
 
+/**
+ * \brief a dense Layer with its weights stored in the given precision
+ */
+template <Activation Act>
+Interface* create_dense(size_type I, size_type O, Precision precision) {
+  switch (precision) {
+    case FP16:
+      return new Layer<Act, false, half_t>(I, O);
+    case BF16:
+      return new Layer<Act, false, bfloat16_t>(I, O);
+    default:
+      return new Layer<Act, false>(I, O);
+  }
+}
+
+/**
+ * \param dense set if the layer is a dense Layer, the only one stored in
+ *              the given precision
+ */
 Interface* create_layer(size_type I, size_type O,
-                        size_type layer, size_type num_layers) {
+                        size_type layer, size_type num_layers,
+                        Precision precision, bool fast_scan, bool& dense) {
   const size_type THRESHOLD = 1 << 8;
   if (layer == num_layers - 1) {
-    if (O >= THRESHOLD) {
+    if (O >= THRESHOLD && fast_scan) {
+      std::cout << "building 4-bit PQLayer<SoftMax> "
+                << I << " x " << O << std::endl;
+      return new PQLayer<SoftMax, true, false, 8, 16, uint8_t, 32>(I, O);
+    } else if (O >= THRESHOLD) {
       std::cout << "building PQLayer<SoftMax> "
                 << I << " x " << O << std::endl;
       return new PQLayer<SoftMax, true, false>(I, O);
@@ -18,7 +43,8 @@ Interface* create_layer(size_type I, size_type O,
 
     std::cout << "building Layer<SoftMax> "
               << I << " x " << O << std::endl;
-    return new Layer<SoftMax, false>(I, O);
+    dense = true;
+    return create_dense<SoftMax>(I, O, precision);
 
   } else {
     if (O >= THRESHOLD) {
@@ -34,7 +60,8 @@ Interface* create_layer(size_type I, size_type O,
 
     std::cout << "building Layer<ReLu> "
               << I << " x " << O << std::endl;
-    return new Layer<ReLu, false>(I, O);
+    dense = true;
+    return create_dense<ReLu>(I, O, precision);
   }
 }
 
@@ -42,18 +69,31 @@ Network::Network(int *layer_size,
                  const int num_layers,
                  const int batch_size,
                  const Optimizer& optimizer,
-                 const int input_dim) : optimizer_(optimizer) {
+                 const int input_dim,
+                 Precision precision,
+                 bool fast_scan) : optimizer_(optimizer) {
   layer_size_ = layer_size;
   num_layers_ = num_layers;
   batch_size_ = batch_size;
   input_dim_ = input_dim;
   layer_.reserve(static_cast<size_t >(num_layers_));
 
+  bool dense = false;
   layer_.emplace_back(
-    create_layer(input_dim_, layer_size_[0], 0, num_layers_));
+    create_layer(input_dim_, layer_size_[0], 0, num_layers_, precision,
+                 fast_scan, dense));
   for (int i = 1; i < num_layers_; ++i) {
     layer_.emplace_back(
-      create_layer(layer_size_[i-1], layer_size_[i], i, num_layers_));
+      create_layer(layer_size_[i-1], layer_size_[i], i, num_layers_,
+                   precision, fast_scan, dense));
+  }
+  // the PQ/CPQ codebooks, norms and biases are kept in fp32
+  if (precision != FP32 && !dense) {
+    for (auto l : layer_) {
+      delete l;
+    }
+    throw std::runtime_error("the precision applies to the dense layers "
+                             "only, the network has none");
   }
   std::cout << "building network, done" << std::endl;
 }
@@ -65,36 +105,74 @@ Network::~Network() {
   layer_.clear();
 }
 
-int Network::predict(int **input_indices, float **input_values,
-                     int *lengths, int **labels, int *label_size) {
-  int correct = 0;
+size_type Network::top1(const SparseRow& x, bool quantized) {
+  ArenaScope scope;  // every temporary of the sample lives in the arena
+  // forward pass for one sample, reading the record in place
+  SparseVector activation = quantized ? layer_[0]->infer(x)
+                                      : layer_[0]->forward(x);
+  for (int i = 1; i < num_layers_; ++i) {
+    activation = quantized ? layer_[i]->infer(activation)
+                           : layer_[i]->forward(activation);
+  }
+  if (activation.size() == 0)
+    throw std::runtime_error("predict 0 classed");
+  T max_act = activation.value_[0];
+  size_type predict_class = activation.index_[0];
+  for (int k = 1; k < activation.size(); k++) {
+    T cur_act = activation.value_[k];
+    if (max_act < cur_act) {
+      max_act = cur_act;
+      predict_class = activation.index_[k];
+    }
+  }
+  return predict_class;
+}
+
+bool Network::across_batch(size_type rows) const {
+  const size_type threads = omp_get_max_threads();
+  if (rows >= threads)
+    return true;
+  const size_type widest =
+    *std::max_element(layer_size_, layer_size_ + num_layers_);
+  return widest < 2 * SHARD_OUTPUTS;
+}
+
+void Network::top_k(const TopK& top_k) {
+  layer_[num_layers_ - 1]->top_k(top_k);
+}
+
+void Network::quantize() {
+  for (auto layer : layer_) {
+    layer->quantize();
+  }
+}
+
+int Network::agreement(const SparseBatch& batch) {
+  int agree = 0;
 #ifndef DEBUG
-#pragma omp parallel for reduction(+:correct)
+#pragma omp parallel for reduction(+:agree) schedule(dynamic, 16) \
+  if(across_batch(batch.rows))
 #endif
-  for (int b = 0; b < batch_size_; ++b) {
-    // construct from input
-    SparseVector activation = SparseVector(input_indices[b],
-                                           input_values[b], lengths[b]);
-    vector<int > labels_(labels[b], labels[b]+label_size[b]);
+  for (int b = 0; b < batch.rows; ++b) {
+    const SparseRow x = batch.row(b);
+    if (top1(x, false) == top1(x, true))
+      agree++;
+  }
+  return agree;
+}
 
-    // forward pass for one sample
-    for (int i = 0; i < num_layers_; ++i) {
-      activation = layer_[i]->forward(activation);
-    }
-    if (activation.size() == 0)
-      throw std::runtime_error("predict 0 classed");
-    T max_act = activation.value_[0];
-    int predict_class = activation.index_[0];
-    for (int k = 1; k < activation.size(); k++) {
-      T cur_act = activation.value_[k];
-      if (max_act < cur_act) {
-        max_act = cur_act;
-        predict_class = activation.index_[k];
-      }
-    }
+int Network::predict(const SparseBatch& batch, bool quantized) {
+  int correct = 0;
+#ifndef DEBUG
+#pragma omp parallel for reduction(+:correct) schedule(dynamic, 16) \
+  if(across_batch(batch.rows))
+#endif
+  for (int b = 0; b < batch.rows; ++b) {
+    const size_type predict_class = top1(batch.row(b), quantized);
 
-    if (labels[b]+label_size[b] !=
-        std::find(labels[b], labels[b] + label_size[b], predict_class)) {
+    const size_type* labels = batch.labels(b);
+    const size_type* labels_end = labels + batch.num_labels(b);
+    if (labels_end != std::find(labels, labels_end, predict_class)) {
       correct++;
     }
   }
@@ -102,29 +180,32 @@ int Network::predict(int **input_indices, float **input_values,
 }
 
 
-float Network::train(int **input_indices, float **input_values,
-                     int *lengths, int **labels, int *label_size) {
+float Network::train(const SparseBatch& batch) {
   float loss = 0;
 #ifndef DEBUG
-#pragma omp parallel for reduction(+:loss)
+#pragma omp parallel for schedule(static) reduction(+:loss)
 #endif
-  for (int b = 0; b < batch_size_; ++b) {
-    vector<SparseVector > activations((size_t)num_layers_ + 1);
-
-    // construct from input
-    activations[0] = SparseVector(input_indices[b],
-                                  input_values[b], lengths[b]);
-    vector<int > labels_(labels[b], labels[b] + label_size[b]);
-
-    // forward pass for one sample
+  for (int b = 0; b < batch.rows; ++b) {
+    ArenaScope scope;  // every temporary of the sample lives in the arena
+    // activations[i] is the output of layer i, the input is not copied
+    ArenaVector<SparseVector > activations((size_t)num_layers_);
+    const SparseRow x = batch.row(b);
+
+    // forward pass for one sample, the output layer keeps the labels
+    // among its selected outputs
     for (int i = 0; i < num_layers_; ++i) {
-      activations[i+1] = layer_[i]->forward(activations[i]);
+      const SparseRow input = i == 0 ? x : SparseRow(activations[i-1]);
+      activations[i] = i == num_layers_ - 1
+        ? layer_[i]->forward_labeled(input, batch.labels(b),
+                                     batch.num_labels(b))
+        : layer_[i]->forward(input);
     }
     // compute loss
     float loss_b = 0;
     // gradient with respect to last layer output(pre SoftMax)
     SparseVector grad = SoftMaxCrossEntropy::compute(
-        activations[num_layers_], labels_, &loss_b);
+        activations[num_layers_-1], batch.labels(b), batch.num_labels(b),
+        &loss_b);
     loss += loss_b;
 
     // backward and update
@@ -132,10 +213,14 @@ float Network::train(int **input_indices, float **input_values,
       if (grad.size() == 0) {
         break;
       }
-      grad = layer_[i]->backward(grad, activations[i], optimizer_, i != 0);
-      activations[i].clear();
+      const SparseRow input = i == 0 ? x : SparseRow(activations[i-1]);
+      grad = layer_[i]->backward(grad, input, optimizer_, i != 0);
     }
   }
+  // the minibatch, or the Hogwild updates that met a conflict
+  for (auto layer : layer_) {
+    layer->apply(optimizer_);
+  }
   return loss;
 }
 
@@ -0,0 +1,733 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <immintrin.h>
+#include "../include/simd.h"
+
+namespace {
+
+void axpy_scalar(size_type n, T a, const T* x, T* y) {
+  for (size_type k = 0; k < n; ++k) {
+    y[k] += a * x[k];
+  }
+}
+
+T dot_scalar(size_type n, const T* x, const T* y) {
+  T sum = 0;
+  for (size_type k = 0; k < n; ++k) {
+    sum += x[k] * y[k];
+  }
+  return sum;
+}
+
+T sparse_dot_scalar(size_type n, const size_type* index, const T* value,
+                    const T* y) {
+  T sum = 0;
+  for (size_type k = 0; k < n; ++k) {
+    sum += value[k] * y[index[k]];
+  }
+  return sum;
+}
+
+void sparse_axpy_scalar(size_type n, T a, const size_type* index,
+                        const T* value, T* y) {
+  for (size_type k = 0; k < n; ++k) {
+    y[index[k]] += a * value[k];
+  }
+}
+
+__attribute__((target("avx2,fma")))
+inline T reduce_avx2(__m256 v) {
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(v),
+                        _mm256_extractf128_ps(v, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+  s = _mm_add_ss(s, _mm_movehdup_ps(s));
+  return _mm_cvtss_f32(s);
+}
+
+__attribute__((target("avx2,fma")))
+void axpy_avx2(size_type n, T a, const T* x, T* y) {
+  const __m256 va = _mm256_set1_ps(a);
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 vy = _mm256_loadu_ps(y + k);
+    vy = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + k), vy);
+    _mm256_storeu_ps(y + k, vy);
+  }
+  for (; k < n; ++k) {
+    y[k] += a * x[k];
+  }
+}
+
+__attribute__((target("avx2,fma")))
+T dot_avx2(size_type n, const T* x, const T* y) {
+  __m256 sum = _mm256_setzero_ps();
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), _mm256_loadu_ps(y + k), sum);
+  }
+  T rest = 0;
+  for (; k < n; ++k) {
+    rest += x[k] * y[k];
+  }
+  return reduce_avx2(sum) + rest;
+}
+
+__attribute__((target("avx2,fma")))
+T sparse_dot_avx2(size_type n, const size_type* index, const T* value,
+                  const T* y) {
+  __m256 sum = _mm256_setzero_ps();
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i vi = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(index + k));
+    __m256 vy = _mm256_i32gather_ps(y, vi, sizeof(T));
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(value + k), vy, sum);
+  }
+  T rest = 0;
+  for (; k < n; ++k) {
+    rest += value[k] * y[index[k]];
+  }
+  return reduce_avx2(sum) + rest;
+}
+
+__attribute__((target("avx512f")))
+void axpy_avx512(size_type n, T a, const T* x, T* y) {
+  const __m512 va = _mm512_set1_ps(a);
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512 vy = _mm512_loadu_ps(y + k);
+    vy = _mm512_fmadd_ps(va, _mm512_loadu_ps(x + k), vy);
+    _mm512_storeu_ps(y + k, vy);
+  }
+  if (k < n) {
+    const __mmask16 mask = static_cast<__mmask16>((1u << (n - k)) - 1);
+    __m512 vy = _mm512_maskz_loadu_ps(mask, y + k);
+    vy = _mm512_fmadd_ps(va, _mm512_maskz_loadu_ps(mask, x + k), vy);
+    _mm512_mask_storeu_ps(y + k, mask, vy);
+  }
+}
+
+__attribute__((target("avx512f")))
+T dot_avx512(size_type n, const T* x, const T* y) {
+  __m512 sum = _mm512_setzero_ps();
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(x + k), _mm512_loadu_ps(y + k), sum);
+  }
+  if (k < n) {
+    const __mmask16 mask = static_cast<__mmask16>((1u << (n - k)) - 1);
+    sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, x + k),
+                          _mm512_maskz_loadu_ps(mask, y + k), sum);
+  }
+  return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+T sparse_dot_avx512(size_type n, const size_type* index, const T* value,
+                    const T* y) {
+  __m512 sum = _mm512_setzero_ps();
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512i vi = _mm512_loadu_si512(index + k);
+    __m512 vy = _mm512_i32gather_ps(vi, y, sizeof(T));
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(value + k), vy, sum);
+  }
+  if (k < n) {
+    const __mmask16 mask = static_cast<__mmask16>((1u << (n - k)) - 1);
+    __m512i vi = _mm512_maskz_loadu_epi32(mask, index + k);
+    __m512 vy = _mm512_mask_i32gather_ps(_mm512_setzero_ps(), mask, vi, y,
+                                         sizeof(T));
+    sum = _mm512_fmadd_ps(_mm512_maskz_loadu_ps(mask, value + k), vy, sum);
+  }
+  return _mm512_reduce_add_ps(sum);
+}
+
+__attribute__((target("avx512f")))
+void sparse_axpy_avx512(size_type n, T a, const size_type* index,
+                        const T* value, T* y) {
+  const __m512 va = _mm512_set1_ps(a);
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512i vi = _mm512_loadu_si512(index + k);
+    __m512 vy = _mm512_i32gather_ps(vi, y, sizeof(T));
+    vy = _mm512_fmadd_ps(va, _mm512_loadu_ps(value + k), vy);
+    _mm512_i32scatter_ps(y, vi, vy, sizeof(T));
+  }
+  for (; k < n; ++k) {
+    y[index[k]] += a * value[k];
+  }
+}
+
+// half and bfloat16 parameters: widened to fp32 eight or sixteen at a time
+
+template <typename W>
+void axpy_scalar(size_type n, T a, const W* x, T* y) {
+  for (size_type k = 0; k < n; ++k) {
+    y[k] += a * to_float(x[k]);
+  }
+}
+
+template <typename W>
+T dot_scalar(size_type n, const T* x, const W* y) {
+  T sum = 0;
+  for (size_type k = 0; k < n; ++k) {
+    sum += x[k] * to_float(y[k]);
+  }
+  return sum;
+}
+
+// 16-bit elements cannot be gathered, the sparse dot stays scalar
+template <typename W>
+T sparse_dot_scalar(size_type n, const size_type* index, const T* value,
+                    const W* y) {
+  T sum = 0;
+  for (size_type k = 0; k < n; ++k) {
+    sum += value[k] * to_float(y[index[k]]);
+  }
+  return sum;
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 load8(const half_t* p) {
+  return _mm256_cvtph_ps(_mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m256 load8(const bfloat16_t* p) {
+  __m256i w = _mm256_cvtepu16_epi32(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(p)));
+  return _mm256_castsi256_ps(_mm256_slli_epi32(w, 16));
+}
+
+template <typename W>
+__attribute__((target("avx2,fma,f16c")))
+void axpy_avx2(size_type n, T a, const W* x, T* y) {
+  const __m256 va = _mm256_set1_ps(a);
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 vy = _mm256_loadu_ps(y + k);
+    vy = _mm256_fmadd_ps(va, load8(x + k), vy);
+    _mm256_storeu_ps(y + k, vy);
+  }
+  for (; k < n; ++k) {
+    y[k] += a * to_float(x[k]);
+  }
+}
+
+template <typename W>
+__attribute__((target("avx2,fma,f16c")))
+T dot_avx2(size_type n, const T* x, const W* y) {
+  __m256 sum = _mm256_setzero_ps();
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    sum = _mm256_fmadd_ps(_mm256_loadu_ps(x + k), load8(y + k), sum);
+  }
+  T rest = 0;
+  for (; k < n; ++k) {
+    rest += x[k] * to_float(y[k]);
+  }
+  return reduce_avx2(sum) + rest;
+}
+
+__attribute__((target("avx512f")))
+inline __m512 load16(const half_t* p) {
+  return _mm512_cvtph_ps(
+    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+}
+
+__attribute__((target("avx512f")))
+inline __m512 load16(const bfloat16_t* p) {
+  __m512i w = _mm512_cvtepu16_epi32(
+    _mm256_loadu_si256(reinterpret_cast<const __m256i*>(p)));
+  return _mm512_castsi512_ps(_mm512_slli_epi32(w, 16));
+}
+
+template <typename W>
+__attribute__((target("avx512f")))
+void axpy_avx512(size_type n, T a, const W* x, T* y) {
+  const __m512 va = _mm512_set1_ps(a);
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512 vy = _mm512_loadu_ps(y + k);
+    vy = _mm512_fmadd_ps(va, load16(x + k), vy);
+    _mm512_storeu_ps(y + k, vy);
+  }
+  for (; k < n; ++k) {
+    y[k] += a * to_float(x[k]);
+  }
+}
+
+template <typename W>
+__attribute__((target("avx512f")))
+T dot_avx512(size_type n, const T* x, const W* y) {
+  __m512 sum = _mm512_setzero_ps();
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    sum = _mm512_fmadd_ps(_mm512_loadu_ps(x + k), load16(y + k), sum);
+  }
+  T rest = 0;
+  for (; k < n; ++k) {
+    rest += x[k] * to_float(y[k]);
+  }
+  return _mm512_reduce_add_ps(sum) + rest;
+}
+
+template <typename W>
+void axpy_round_scalar(size_type n, T a, const T* x, W* y) {
+  for (size_type k = 0; k < n; ++k) {
+    add_rounded(y[k], a * x[k]);
+  }
+}
+
+// per-lane xorshift streams of the calling thread for stochastic rounding
+struct alignas(64) RoundingLanes {
+  uint32_t s[16];
+  RoundingLanes() {
+    for (uint32_t k = 0; k < 16; ++k)
+      s[k] = rounding_seed(k + 1);  // 0 is the stream of rounding_bits
+  }
+};
+thread_local RoundingLanes lanes;
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m256i xorshift8(__m256i s) {
+  s = _mm256_xor_si256(s, _mm256_slli_epi32(s, 13));
+  s = _mm256_xor_si256(s, _mm256_srli_epi32(s, 17));
+  return _mm256_xor_si256(s, _mm256_slli_epi32(s, 5));
+}
+
+// stochastic rounding of eight fp32 to bfloat16: a random carry into the
+// kept bits, or to half: the magnitude truncated, then one ulp up with
+// probability of the distance over the ulp
+__attribute__((target("avx2,fma,f16c")))
+inline __m128i round8(__m256 v, __m256i random, bfloat16_t*) {
+  __m256i x = _mm256_add_epi32(_mm256_castps_si256(v),
+                               _mm256_srli_epi32(random, 16));
+  x = _mm256_srli_epi32(x, 16);
+  return _mm_packus_epi32(_mm256_castsi256_si128(x),
+                          _mm256_extracti128_si256(x, 1));
+}
+
+__attribute__((target("avx2,fma,f16c")))
+inline __m128i round8(__m256 v, __m256i random, half_t*) {
+  const __m128i low = _mm256_cvtps_ph(v, _MM_FROUND_TO_ZERO);
+  const __m128i high = _mm_add_epi16(low, _mm_set1_epi16(1));
+  const __m256 f_low = _mm256_cvtph_ps(low);
+  const __m256 p = _mm256_div_ps(_mm256_sub_ps(v, f_low),
+                                 _mm256_sub_ps(_mm256_cvtph_ps(high), f_low));
+  // uniform in [0, 1) from the upper 24 random bits
+  const __m256 u = _mm256_mul_ps(
+    _mm256_cvtepi32_ps(_mm256_srli_epi32(random, 8)),
+    _mm256_set1_ps(1.f / (1u << 24)));
+  __m256i up = _mm256_castps_si256(_mm256_cmp_ps(u, p, _CMP_LT_OQ));
+  up = _mm256_srli_epi32(up, 31);
+  const __m128i up16 = _mm_packus_epi32(_mm256_castsi256_si128(up),
+                                        _mm256_extracti128_si256(up, 1));
+  return _mm_add_epi16(low, up16);
+}
+
+template <typename W>
+__attribute__((target("avx2,fma,f16c")))
+void axpy_round_avx2(size_type n, T a, const T* x, W* y) {
+  const __m256 va = _mm256_set1_ps(a);
+  __m256i random = _mm256_load_si256(reinterpret_cast<__m256i*>(lanes.s));
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    const __m256 v = _mm256_fmadd_ps(va, _mm256_loadu_ps(x + k), load8(y + k));
+    random = xorshift8(random);
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(y + k),
+                     round8(v, random, y));
+  }
+  _mm256_store_si256(reinterpret_cast<__m256i*>(lanes.s), random);
+  for (; k < n; ++k) {
+    add_rounded(y[k], a * x[k]);
+  }
+}
+
+void accumulate_int8_scalar(size_type n, int16_t a0, const int8_t* q0,
+                            int16_t a1, const int8_t* q1, int32_t* acc) {
+  for (size_type k = 0; k < n; ++k) {
+    acc[k] += a0 * q0[k] + a1 * q1[k];
+  }
+}
+
+// sixteen outputs of both rows widened to int16 and interleaved as
+// (q0[k], q1[k]) pairs, lo holds outputs [0, 8) and hi [8, 16)
+__attribute__((target("avx2,fma,f16c")))
+inline void pairs16(const int8_t* q0, const int8_t* q1,
+                    __m256i* lo, __m256i* hi) {
+  __m256i r0 = _mm256_cvtepi8_epi16(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(q0)));
+  __m256i r1 = _mm256_cvtepi8_epi16(
+    _mm_loadu_si128(reinterpret_cast<const __m128i*>(q1)));
+  r0 = _mm256_permute4x64_epi64(r0, 0xD8);
+  r1 = _mm256_permute4x64_epi64(r1, 0xD8);
+  *lo = _mm256_unpacklo_epi16(r0, r1);
+  *hi = _mm256_unpackhi_epi16(r0, r1);
+}
+
+__attribute__((target("avx2,fma,f16c")))
+void accumulate_int8_avx2(size_type n, int16_t a0, const int8_t* q0,
+                          int16_t a1, const int8_t* q1, int32_t* acc) {
+  const __m256i a = _mm256_set1_epi32(
+    static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(a1)) << 16)
+                         | static_cast<uint16_t>(a0)));
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m256i lo, hi;
+    pairs16(q0 + k, q1 + k, &lo, &hi);
+    __m256i* out = reinterpret_cast<__m256i*>(acc + k);
+    _mm256_storeu_si256(out, _mm256_add_epi32(
+      _mm256_loadu_si256(out), _mm256_madd_epi16(lo, a)));
+    _mm256_storeu_si256(out + 1, _mm256_add_epi32(
+      _mm256_loadu_si256(out + 1), _mm256_madd_epi16(hi, a)));
+  }
+  accumulate_int8_scalar(n - k, a0, q0 + k, a1, q1 + k, acc + k);
+}
+
+// VNNI fuses the multiply of the pairs with the accumulation
+__attribute__((target("avx2,fma,f16c,avx512f,avx512vl,avx512vnni")))
+void accumulate_int8_vnni(size_type n, int16_t a0, const int8_t* q0,
+                          int16_t a1, const int8_t* q1, int32_t* acc) {
+  const __m256i a = _mm256_set1_epi32(
+    static_cast<int32_t>((static_cast<uint32_t>(static_cast<uint16_t>(a1)) << 16)
+                         | static_cast<uint16_t>(a0)));
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m256i lo, hi;
+    pairs16(q0 + k, q1 + k, &lo, &hi);
+    __m256i* out = reinterpret_cast<__m256i*>(acc + k);
+    _mm256_storeu_si256(out, _mm256_dpwssd_epi32(
+      _mm256_loadu_si256(out), lo, a));
+    _mm256_storeu_si256(out + 1, _mm256_dpwssd_epi32(
+      _mm256_loadu_si256(out + 1), hi, a));
+  }
+  accumulate_int8_scalar(n - k, a0, q0 + k, a1, q1 + k, acc + k);
+}
+
+void fast_scan_block_scalar(size_type m, const uint8_t* codes,
+                            const uint8_t* lut, uint16_t* sum) {
+  std::fill(sum, sum + 32, 0);
+  for (size_type s = 0; s < m; ++s, codes += 16, lut += 16) {
+    for (int j = 0; j < 16; ++j) {
+      sum[j] += lut[codes[j] & 0x0f];
+      sum[j + 16] += lut[codes[j] >> 4];
+    }
+  }
+}
+
+// two subspaces per register, one per 128-bit lane, as pshufb looks up
+// each lane in its own 16 bytes: the tables and the codes of subspaces
+// s and s + 1 are contiguous. The lanes are summed at the end
+__attribute__((target("avx2,fma,f16c")))
+void fast_scan_block_avx2(size_type m, const uint8_t* codes,
+                          const uint8_t* lut, uint16_t* sum) {
+  const __m256i nibble = _mm256_set1_epi8(0x0f);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i acc[4] = {zero, zero, zero, zero};
+  for (size_type s = 0; s < m; s += 2, codes += 32, lut += 32) {
+    __m256i table, c;
+    if (s + 1 < m) {
+      table = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(lut));
+      c = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(codes));
+    } else {
+      table = _mm256_zextsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(lut)));
+      c = _mm256_zextsi128_si256(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(codes)));
+    }
+    const __m256i lo = _mm256_shuffle_epi8(table, _mm256_and_si256(c, nibble));
+    const __m256i hi = _mm256_shuffle_epi8(
+      table, _mm256_and_si256(_mm256_srli_epi16(c, 4), nibble));
+    acc[0] = _mm256_add_epi16(acc[0], _mm256_unpacklo_epi8(lo, zero));
+    acc[1] = _mm256_add_epi16(acc[1], _mm256_unpackhi_epi8(lo, zero));
+    acc[2] = _mm256_add_epi16(acc[2], _mm256_unpacklo_epi8(hi, zero));
+    acc[3] = _mm256_add_epi16(acc[3], _mm256_unpackhi_epi8(hi, zero));
+  }
+  for (int i = 0; i < 4; ++i) {
+    _mm_storeu_si128(reinterpret_cast<__m128i*>(sum + 8 * i),
+                     _mm_add_epi16(_mm256_castsi256_si128(acc[i]),
+                                   _mm256_extracti128_si256(acc[i], 1)));
+  }
+}
+
+// output k of gather_sum, scale is null for the plain sum
+inline T gather_one(size_type k, size_type m, const uint8_t* code,
+                    size_type stride, const T* table, size_type ks,
+                    const T* bias, const T* scale) {
+  T mm = bias[k];
+  for (size_type s = 0; s < m; ++s) {
+    const T t = table[s * ks + code[s * stride + k]];
+    mm += scale ? t * scale[s * stride + k] : t;
+  }
+  return mm;
+}
+
+void gather_sum_scalar(size_type n, size_type m, const uint8_t* code,
+                       size_type stride, const T* table, size_type ks,
+                       const T* bias, const T* scale, T* sum) {
+  for (size_type k = 0; k < n; ++k) {
+    sum[k] = gather_one(k, m, code, stride, table, ks, bias, scale);
+  }
+}
+
+// the sums stay in registers over the subspaces, they are stored once
+__attribute__((target("avx2,fma")))
+void gather_sum_avx2(size_type n, size_type m, const uint8_t* code,
+                     size_type stride, const T* table, size_type ks,
+                     const T* bias, const T* scale, T* sum) {
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256 mm = _mm256_loadu_ps(bias + k);
+    for (size_type s = 0; s < m; ++s) {
+      const size_type offset = s * stride + k;
+      const __m256i vi = _mm256_cvtepu8_epi32(
+        _mm_loadl_epi64(reinterpret_cast<const __m128i*>(code + offset)));
+      __m256 t = _mm256_i32gather_ps(table + s * ks, vi, sizeof(T));
+      if (scale)
+        t = _mm256_mul_ps(t, _mm256_loadu_ps(scale + offset));
+      mm = _mm256_add_ps(mm, t);
+    }
+    _mm256_storeu_ps(sum + k, mm);
+  }
+  for (; k < n; ++k) {
+    sum[k] = gather_one(k, m, code, stride, table, ks, bias, scale);
+  }
+}
+
+__attribute__((target("avx512f")))
+void gather_sum_avx512(size_type n, size_type m, const uint8_t* code,
+                       size_type stride, const T* table, size_type ks,
+                       const T* bias, const T* scale, T* sum) {
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512 mm = _mm512_loadu_ps(bias + k);
+    for (size_type s = 0; s < m; ++s) {
+      const size_type offset = s * stride + k;
+      const __m512i vi = _mm512_cvtepu8_epi32(
+        _mm_loadu_si128(reinterpret_cast<const __m128i*>(code + offset)));
+      __m512 t = _mm512_i32gather_ps(vi, table + s * ks, sizeof(T));
+      if (scale)
+        t = _mm512_mul_ps(t, _mm512_loadu_ps(scale + offset));
+      mm = _mm512_add_ps(mm, t);
+    }
+    _mm512_storeu_ps(sum + k, mm);
+  }
+  for (; k < n; ++k) {
+    sum[k] = gather_one(k, m, code, stride, table, ks, bias, scale);
+  }
+}
+
+void gather_sum_u8_scalar(size_type n, size_type m, const uint8_t* code,
+                          size_type stride, const uint8_t* table,
+                          size_type ks, int32_t* sum) {
+  for (size_type k = 0; k < n; ++k) {
+    int32_t mm = 0;
+    for (size_type s = 0; s < m; ++s)
+      mm += table[s * ks + code[s * stride + k]];
+    sum[k] = mm;
+  }
+}
+
+// a byte is gathered as the low byte of a 32-bit load at its address
+__attribute__((target("avx2,fma")))
+void gather_sum_u8_avx2(size_type n, size_type m, const uint8_t* code,
+                        size_type stride, const uint8_t* table,
+                        size_type ks, int32_t* sum) {
+  const __m256i low = _mm256_set1_epi32(0xff);
+  size_type k = 0;
+  for (; k + 8 <= n; k += 8) {
+    __m256i mm = _mm256_setzero_si256();
+    for (size_type s = 0; s < m; ++s) {
+      const __m256i vi = _mm256_cvtepu8_epi32(_mm_loadl_epi64(
+        reinterpret_cast<const __m128i*>(code + s * stride + k)));
+      const __m256i t = _mm256_i32gather_epi32(
+        reinterpret_cast<const int*>(table + s * ks), vi, 1);
+      mm = _mm256_add_epi32(mm, _mm256_and_si256(t, low));
+    }
+    _mm256_storeu_si256(reinterpret_cast<__m256i*>(sum + k), mm);
+  }
+  gather_sum_u8_scalar(n - k, m, code + k, stride, table, ks, sum + k);
+}
+
+__attribute__((target("avx512f")))
+void gather_sum_u8_avx512(size_type n, size_type m, const uint8_t* code,
+                          size_type stride, const uint8_t* table,
+                          size_type ks, int32_t* sum) {
+  const __m512i low = _mm512_set1_epi32(0xff);
+  size_type k = 0;
+  for (; k + 16 <= n; k += 16) {
+    __m512i mm = _mm512_setzero_si512();
+    for (size_type s = 0; s < m; ++s) {
+      const __m512i vi = _mm512_cvtepu8_epi32(_mm_loadu_si128(
+        reinterpret_cast<const __m128i*>(code + s * stride + k)));
+      const __m512i t = _mm512_i32gather_epi32(vi, table + s * ks, 1);
+      mm = _mm512_add_epi32(mm, _mm512_and_si512(t, low));
+    }
+    _mm512_storeu_si512(sum + k, mm);
+  }
+  gather_sum_u8_scalar(n - k, m, code + k, stride, table, ks, sum + k);
+}
+
+/**
+ * \brief the kernels of one parameter type at one instruction set
+ */
+template <typename W>
+struct TypedKernels {
+  void (*axpy)(size_type, T, const W*, T*);
+  T (*dot)(size_type, const T*, const W*);
+  T (*sparse_dot)(size_type, const size_type*, const T*, const W*);
+  void (*axpy_round)(size_type, T, const T*, W*);
+};
+
+struct Kernels {
+  SimdLevel level;
+  void (*axpy)(size_type, T, const T*, T*);
+  T (*dot)(size_type, const T*, const T*);
+  T (*sparse_dot)(size_type, const size_type*, const T*, const T*);
+  void (*sparse_axpy)(size_type, T, const size_type*, const T*, T*);
+  TypedKernels<half_t >      half;
+  TypedKernels<bfloat16_t >  bfloat16;
+  void (*accumulate_int8)(size_type, int16_t, const int8_t*,
+                          int16_t, const int8_t*, int32_t*);
+  void (*fast_scan_block)(size_type, const uint8_t*, const uint8_t*,
+                          uint16_t*);
+  void (*gather_sum)(size_type, size_type, const uint8_t*, size_type,
+                     const T*, size_type, const T*, const T*, T*);
+  void (*gather_sum_u8)(size_type, size_type, const uint8_t*, size_type,
+                        const uint8_t*, size_type, int32_t*);
+};
+
+// AVX2 has no scatter, its sparse_axpy is the scalar loop
+const Kernels KERNELS[] = {
+  {SimdScalar, axpy_scalar, dot_scalar, sparse_dot_scalar,
+   sparse_axpy_scalar,
+   {axpy_scalar<half_t>, dot_scalar<half_t>, sparse_dot_scalar<half_t>,
+    axpy_round_scalar<half_t>},
+   {axpy_scalar<bfloat16_t>, dot_scalar<bfloat16_t>,
+    sparse_dot_scalar<bfloat16_t>, axpy_round_scalar<bfloat16_t>},
+   accumulate_int8_scalar, fast_scan_block_scalar, gather_sum_scalar,
+   gather_sum_u8_scalar},
+  {SimdAVX2, axpy_avx2, dot_avx2, sparse_dot_avx2, sparse_axpy_scalar,
+   {axpy_avx2<half_t>, dot_avx2<half_t>, sparse_dot_scalar<half_t>,
+    axpy_round_avx2<half_t>},
+   {axpy_avx2<bfloat16_t>, dot_avx2<bfloat16_t>,
+    sparse_dot_scalar<bfloat16_t>, axpy_round_avx2<bfloat16_t>},
+   accumulate_int8_avx2, fast_scan_block_avx2, gather_sum_avx2,
+   gather_sum_u8_avx2},
+  {SimdAVX512, axpy_avx512, dot_avx512, sparse_dot_avx512,
+   sparse_axpy_avx512,
+   {axpy_avx512<half_t>, dot_avx512<half_t>, sparse_dot_scalar<half_t>,
+    axpy_round_avx2<half_t>},
+   {axpy_avx512<bfloat16_t>, dot_avx512<bfloat16_t>,
+    sparse_dot_scalar<bfloat16_t>, axpy_round_avx2<bfloat16_t>},
+   accumulate_int8_avx2, fast_scan_block_avx2, gather_sum_avx512,
+   gather_sum_u8_avx512},
+};
+
+SimdLevel supported_level() {
+  __builtin_cpu_init();
+  if (__builtin_cpu_supports("avx512f"))
+    return SimdAVX512;
+  if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma") &&
+      __builtin_cpu_supports("f16c"))
+    return SimdAVX2;
+  return SimdScalar;
+}
+
+const Kernels* kernels = &KERNELS[supported_level()];
+
+}  // namespace
+
+SimdLevel simd_level() {
+  return kernels->level;
+}
+
+SimdLevel set_simd_level(SimdLevel level) {
+  kernels = &KERNELS[std::min(level, supported_level())];
+  return kernels->level;
+}
+
+void axpy(size_type n, T a, const T* x, T* y) {
+  kernels->axpy(n, a, x, y);
+}
+
+T dot(size_type n, const T* x, const T* y) {
+  return kernels->dot(n, x, y);
+}
+
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const T* y) {
+  return kernels->sparse_dot(n, index, value, y);
+}
+
+void sparse_axpy(size_type n, T a, const size_type* index, const T* value,
+                 T* y) {
+  kernels->sparse_axpy(n, a, index, value, y);
+}
+
+void axpy(size_type n, T a, const half_t* x, T* y) {
+  kernels->half.axpy(n, a, x, y);
+}
+
+void axpy(size_type n, T a, const bfloat16_t* x, T* y) {
+  kernels->bfloat16.axpy(n, a, x, y);
+}
+
+T dot(size_type n, const T* x, const half_t* y) {
+  return kernels->half.dot(n, x, y);
+}
+
+T dot(size_type n, const T* x, const bfloat16_t* y) {
+  return kernels->bfloat16.dot(n, x, y);
+}
+
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const half_t* y) {
+  return kernels->half.sparse_dot(n, index, value, y);
+}
+
+T sparse_dot(size_type n, const size_type* index, const T* value,
+             const bfloat16_t* y) {
+  return kernels->bfloat16.sparse_dot(n, index, value, y);
+}
+
+void axpy_round(size_type n, T a, const T* x, half_t* y) {
+  kernels->half.axpy_round(n, a, x, y);
+}
+
+void axpy_round(size_type n, T a, const T* x, bfloat16_t* y) {
+  kernels->bfloat16.axpy_round(n, a, x, y);
+}
+
+void accumulate_int8(size_type n, int16_t a0, const int8_t* q0,
+                     int16_t a1, const int8_t* q1, int32_t* acc) {
+  static const bool vnni = __builtin_cpu_supports("avx512vnni");
+  if (vnni && kernels->level == SimdAVX512)
+    accumulate_int8_vnni(n, a0, q0, a1, q1, acc);
+  else
+    kernels->accumulate_int8(n, a0, q0, a1, q1, acc);
+}
+
+void fast_scan_block(size_type m, const uint8_t* codes, const uint8_t* lut,
+                     uint16_t* sum) {
+  kernels->fast_scan_block(m, codes, lut, sum);
+}
+
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const T* table, size_type ks,
+                const T* bias, T* sum) {
+  kernels->gather_sum(n, m, code, stride, table, ks, bias, nullptr, sum);
+}
+
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const T* table, size_type ks,
+                const T* bias, const T* scale, T* sum) {
+  kernels->gather_sum(n, m, code, stride, table, ks, bias, scale, sum);
+}
+
+void gather_sum(size_type n, size_type m, const uint8_t* code,
+                size_type stride, const uint8_t* table, size_type ks,
+                int32_t* sum) {
+  kernels->gather_sum_u8(n, m, code, stride, table, ks, sum);
+}
@@ -10,6 +10,7 @@
 #include <iterator>
 #include <algorithm>
 #include <vector>
+#include "../include/arena.h"
 #include "../include/vq.h"
 #include "../include/progress_bar.h"
 
@@ -43,6 +44,30 @@ size_type nvq(T* norm, T* w, const T* dict, size_type ks, size_type d) {
   return vq(w, dict, ks, d);
 }
 
+/**
+ * \param w    shape of [d]
+ * \param dict shape of [d, ks], the codewords are the columns
+ * \return     the nearest codeword, distances of all the codewords are
+ *             accumulated together one dimension at a time
+ */
+size_type vq_transposed(const T* w, const T* dict, size_type ks, size_type d) {
+  ArenaVector<T > dist(ks, 0);
+  for (int dim = 0; dim < d; ++dim, dict += ks) {
+    const T wv = w[dim];
+    for (int k = 0; k < ks; ++k) {
+      T diff = wv - dict[k];
+      dist[k] += diff * diff;
+    }
+  }
+  return std::min_element(dist.begin(), dist.end()) - dist.begin();
+}
+
+size_type nvq_transposed(T* norm, T* w, const T* dict,
+                         size_type ks, size_type d) {
+  *norm = normalize(w, d);
+  return vq_transposed(w, dict, ks, d);
+}
+
 T norm_sqr(T* w, size_type d) {
   T norm_sqr = 0;
   for (int i = 0; i < d; ++i) {
@@ -69,6 +94,21 @@ void normalize_codebook(T* dict, size_type m, size_type ks, size_type d) {
   }
 }
 
+/**
+ * \param dict_t shape of [m, d, ks]
+ * \param dict   shape of [m, ks, d]
+ */
+void transpose_codebook(T* dict_t, const T* dict,
+                        size_type m, size_type ks, size_type d) {
+  for (int i = 0; i < m; ++i, dict += ks * d, dict_t += ks * d) {
+    for (int k = 0; k < ks; ++k) {
+      for (int dim = 0; dim < d; ++dim) {
+        dict_t[dim * ks + k] = dict[k * d + dim];
+      }
+    }
+  }
+}
+
 /**
  * \param w    shape of [d]
  * \param dict shape of [m, ks, d]
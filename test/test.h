@@ -25,7 +25,7 @@ class FakeLayer : public Layer<Act, Select> {
 };
 
 
-void dump(const SparseVector& s) {
+void dump(const SparseRow& s) {
   for (int i = 0; i < s.size(); ++i) {
     std::cout << s.index_[i] << " : " << s.value_[i] <<"\t";
   }
@@ -69,7 +69,7 @@ void compare(std::string variable,
 
 
 void compare(std::string variable,
-             SparseVector s, const T* p, int size) {
+             SparseRow s, const T* p, int size) {
   bool success = true;
   for (int i = 0; i < s.size(); ++i) {
     if (std::abs(s.value_[i] - p[s.index_[i]]) > 0.001) {
@@ -86,7 +86,7 @@ void compare(std::string variable,
 }
 
 void compare(std::string variable,
-             SparseVector s, SparseVector p) {
+             SparseRow s, SparseRow p) {
   bool success = true;
   if (s.size() != p.size()) {
     success = false;
@@ -108,3 +108,13 @@ void compare(std::string variable,
   std::cout << "\t\t";
   dump(p);
 }
+
+void compare(std::string variable,
+             const SparseVector& s, const SparseVector& p) {
+  compare(variable, SparseRow(s), SparseRow(p));
+}
+
+void compare(std::string variable,
+             const SparseVector& s, const T* p, int size) {
+  compare(variable, SparseRow(s), p, size);
+}
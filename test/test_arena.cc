@@ -0,0 +1,35 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include "test.h"
+#include "../include/arena.h"
+
+int main() {
+  // outside of any scope the vectors live on the heap
+  SparseVector heap;
+  heap.push_back(1, 0.5);
+  compare("heap allocator", (int)(heap.index_.get_allocator().arena_ == nullptr), 1);
+
+  Arena& arena = Arena::local();
+  const char* first = nullptr;
+  for (int sample = 0; sample < 3; ++sample) {
+    ArenaScope scope;
+    SparseVector x;
+    for (int i = 0; i < 1000; ++i)
+      x.push_back(i, i * 0.5f);
+    SparseVector copy = x;
+    compare("arena allocator", (int)(copy.value_.get_allocator().arena_ == &arena), 1);
+    compare("arena copy", copy.value_.data(), x.value_.data(), 1000);
+    {
+      ArenaScope nested;
+      ArenaVector<T > buffer(1 << 21);  // larger than a block
+    }
+    // every sample reuses the same memory
+    if (sample == 0)
+      first = reinterpret_cast<const char*>(x.index_.data());
+    else
+      compare("rewound", (int)(reinterpret_cast<const char*>(x.index_.data()) == first), 1);
+  }
+  compare("no growth", (int)(arena.capacity() <= (3 << 20) + (1 << 23)), 1);
+  compare("scope closed", (int)(Arena::active() == nullptr), 1);
+}
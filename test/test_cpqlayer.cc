@@ -37,6 +37,34 @@ void test_cpq(int seed) {
   compare("RQ backward gx", gx, gx_);
 }
 
+/**
+ * \brief the top k and the mass cutoff are those of the dense layer
+ */
+void test_cpq_top_k(int seed) {
+  const size_type I = 16, O = 64;
+  CPQLayer<SoftMax, true, false> rq(I, O);
+  FakeLayer<SoftMax, true> fakeVQLayer(rq);
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx;
+  for (int i = 0; i < I; ++i)
+    sx.push_back(i, distribution(generator));
+
+  TopK top_k;
+  top_k.k = 5;
+  rq.top_k(top_k);
+  fakeVQLayer.top_k(top_k);
+  const SparseVector y = rq.forward(sx);
+  compare("CPQ top k size", (int)y.size(), 5);
+  compare("CPQ top k", y, fakeVQLayer.forward(sx));
+
+  top_k.mass = 0.5;
+  rq.top_k(top_k);
+  fakeVQLayer.top_k(top_k);
+  compare("CPQ top mass", rq.forward(sx), fakeVQLayer.forward(sx));
+}
+
 int main() {
   int i = 1016;
   test_cpq<Activation::ReLu, true, true>(i++);
@@ -48,4 +76,5 @@ int main() {
   test_cpq<Activation::SoftMax, true, false>(i++);
   test_cpq<Activation::SoftMax, false, true>(i++);
   test_cpq<Activation::SoftMax, false, false>(i++);
+  test_cpq_top_k(i++);
 }
@@ -0,0 +1,287 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <fstream>
+#include "test.h"
+#include "../include/compressed_data.h"
+#include "../include/csr_data.h"
+#include "../include/feature_map.h"
+#include "../include/half.h"
+#include "../include/xml_data.h"
+
+#define ALL(c) c.begin(), c.end()
+
+const char* SVM_FILE = "test_data.txt";
+const char* CSR_FILE = "test_data.txt.csr";
+
+void write_svm() {
+  std::ofstream file(SVM_FILE);
+  file << "3 16 8\n"
+       << "1,3 0:0.5 7:1.25 15:2\n"
+       << "-1 2:1e-1\n"
+       << "4,5,6 1:3 3:4 5:6 9:-1\n";
+}
+
+void test_mapped_csr() {
+  convert_svm_to_csr(SVM_FILE, CSR_FILE, true);
+  MappedCSR data(CSR_FILE);
+
+  compare("num_rows", data.num_rows(), 3);
+  compare("num_features", (int)data.header().num_features, 16);
+
+  CSRView view = data.batch(1, 8);
+  compare("batch clipped", view.rows, 2);
+
+  vector<int > sizes = {(int)view.row(0).size(), (int)view.row(1).size()};
+  vector<int > label_sizes = {view.num_labels(0), view.num_labels(1)};
+  vector<int > sizes_ = {1, 4};
+  vector<int > label_sizes_ = {1, 3};
+  compare("sizes", sizes.data(), sizes_.data(), 2);
+  compare("label sizes", label_sizes.data(), label_sizes_.data(), 2);
+
+  vector<int > index_ = {1, 3, 5, 9};
+  vector<float > value_ = {3, 4, 6, -1};
+  vector<int > label_ = {4, 5, 6};
+  compare("indices", view.row(1).index_, index_.data(), 4);
+  compare("values", view.row(1).value_, value_.data(), 4);
+  compare("labels", view.labels(1), label_.data(), 3);
+  compare("negative label", view.labels(0)[0], 0);
+  compare("exponent value", view.row(0).value_[0], 0.1f);
+}
+
+void test_prefetch() {
+  SparseData data(SVM_FILE, 2, true);
+  compare("num_items", data.getNumItems(), 3);
+
+  CSRView view;
+  bool has_next = data.nextBatch(view);
+  compare("first batch", (int)has_next * view.rows, 2);
+  compare("first batch nnz", (int)view.offset[view.rows], 4);
+  has_next = data.nextBatch(view);
+  compare("last batch", (int)has_next * view.rows, 1);
+  compare("last batch label", view.label[view.label_offset[0] + 2], 6);
+  has_next = data.nextBatch(view);
+  compare("end of file", (int)has_next, 0);
+
+  // stops the producer without consuming everything
+  SparseData early(SVM_FILE, 1, true);
+  early.nextBatch(view);
+}
+
+void test_parser() {
+  const char* floats[] = {"0.5", "-1.25e-3", "3", "+7.", ".125", "1E5",
+                          "0.000001", "123456.789"};
+  vector<float > parsed, expected;
+  for (auto f : floats) {
+    T v = 0;
+    parse_float(f, v);
+    parsed.push_back(v);
+    expected.push_back(std::strtof(f, nullptr));
+  }
+  compare("parse_float", parsed.data(), expected.data(), (int)parsed.size());
+
+  // CRLF, no trailing newline, and a buffer smaller than one line
+  std::ofstream("test_parser.txt") << "2,7 1:0.5 3:2\r\n5 4:1\r\n8 2:3";
+  SVMReader reader("test_parser.txt", false, 4);
+  CSRBatch batch;
+  batch.clear();
+  compare("rows", reader.read(batch, 8), 3);
+  vector<int > index_ = {1, 3, 4, 2};
+  vector<int > label_ = {2, 7, 5, 8};
+  compare("indices", batch.index_.data(), index_.data(), 4);
+  compare("labels", batch.label_.data(), label_.data(), 4);
+  compare("end of file", reader.read(batch, 8), 0);
+}
+
+void test_parallel_parser() {
+  {
+    std::ofstream file("test_parallel.txt");
+    file << "100 1000 50\n";
+    for (int r = 0; r < 100; ++r) {
+      file << r % 50 << "," << (r * 7) % 50;
+      for (int f = 0; f < r % 13; ++f)
+        file << " " << r * 10 + f << ":" << f * 0.5;
+      file << "\n";
+    }
+  }
+  omp_set_num_threads(3);
+  CSRBatch sequential, parallel;
+  vector<CSRBatch > chunks;
+  sequential.clear();
+  parallel.clear();
+  SVMReader reader("test_parallel.txt", true);
+  reader.read(sequential, 1000);
+  // small windows, so the records are split over several calls
+  SVMReader parallel_reader("test_parallel.txt", true, 256);
+  while (parallel_reader.read_parallel(parallel, chunks) > 0) {}
+
+  compare("parallel rows", parallel.rows(), sequential.rows());
+  vector<int > offset(ALL(parallel.offset_));
+  vector<int > offset_(ALL(sequential.offset_));
+  vector<int > label_offset(ALL(parallel.label_offset_));
+  vector<int > label_offset_(ALL(sequential.label_offset_));
+  compare("parallel offsets", offset.data(), offset_.data(),
+          sequential.rows() + 1);
+  compare("parallel label offsets", label_offset.data(),
+          label_offset_.data(), sequential.rows() + 1);
+  compare("parallel indices", parallel.index_.data(),
+          sequential.index_.data(), (int)sequential.index_.size());
+  compare("parallel labels", parallel.label_.data(),
+          sequential.label_.data(), (int)sequential.label_.size());
+
+  // two threads of the loader, whatever the size of the team
+  CSRBatch loader;
+  loader.clear();
+  SVMReader loader_reader("test_parallel.txt", true, 256);
+  bool two_chunks = true;
+  while (loader_reader.read_parallel(loader, chunks, 2) > 0)
+    two_chunks = two_chunks && chunks.size() == 2;
+  compare("loader chunks", (int)two_chunks, 1);
+  compare("loader indices", loader.index_.data(),
+          sequential.index_.data(), (int)sequential.index_.size());
+}
+
+void test_shuffled_dataset() {
+  CSRBatch data;
+  load_svm("test_parallel.txt", true, data);
+  CSRDataset dataset(data.view());
+
+  // file order before the first shuffle
+  SparseBatch batch = dataset.batch(1, 32);
+  compare("ordered batch", batch.labels(0)[0], 32);
+
+  dataset.shuffle();
+  vector<int > seen(dataset.num_rows(), 0);
+  for (int b = 0; b * 32 < dataset.num_rows(); ++b) {
+    batch = dataset.batch(b, 32);
+    for (int r = 0; r < batch.rows; ++r) {
+      // every row has two labels, so the label position gives the row
+      seen[(batch.labels(r) - data.label_.data()) / 2]++;
+    }
+  }
+  compare("every row once",
+          (int)std::count(seen.begin(), seen.end(), 1), 100);
+}
+
+void test_feature_map() {
+  // feature 9 appears 3 times, 2 and 5 twice, 0 and 7 once
+  std::ofstream("test_fmap.txt") << "1 2:1 5:2 9:3\n"
+                                 << "2 0:1 9:2\n"
+                                 << "3 2:4 5:5 7:6 9:7\n";
+  CSRBatch data;
+  load_svm("test_fmap.txt", false, data);
+  FeatureMap map(16);
+  map.count(data.view());
+  map.build(2);
+  compare("pruned size", map.size(), 3);
+  vector<int > features_ = {9, 2, 5};
+  compare("frequency order", map.features().data(), features_.data(), 3);
+
+  map.apply(data);
+  vector<int > offset(ALL(data.offset_));
+  vector<int > offset_ = {0, 3, 4, 7};
+  vector<int > index_ = {0, 1, 2, 0, 0, 1, 2};
+  vector<float > value_ = {3, 1, 2, 2, 7, 4, 5};
+  compare("remapped offsets", offset.data(), offset_.data(), 4);
+  compare("remapped indices", data.index_.data(), index_.data(), 7);
+  compare("remapped values", data.value_.data(), value_.data(), 7);
+
+  map.save("test_fmap.txt.fmap");
+  FeatureMap loaded(16);
+  compare("load other min_count", (int)loaded.load("test_fmap.txt.fmap", 3), 0);
+  compare("load", (int)loaded.load("test_fmap.txt.fmap", 2), 1);
+  compare("loaded map", loaded[5], 2);
+  compare("loaded dropped", loaded[7], -1);
+}
+
+void test_half() {
+  const float floats[] = {0.f, 1.f, -2.5f, 0.1f, 65504.f, 6.1e-5f, 3e-7f};
+  vector<float > converted, expected = {0.f, 1.f, -2.5f, 0.0999756f, 65504.f,
+                                        6.1035e-5f, 2.98e-7f};
+  for (float f : floats)
+    converted.push_back(half_to_float(float_to_half(f)));
+  compare("half round trip", converted.data(), expected.data(), 7);
+  compare("half overflow", (int)float_to_half(1e6f), 0x7c00);
+  compare("half ties to even", (int)float_to_half(1.f + 1.f / 2048), 0x3c00);
+}
+
+void test_compressed() {
+  CSRBatch text, ones;
+  load_svm("test_parallel.txt", true, text);
+
+  // one block of values all ones, stored without values
+  ones.clear();
+  ones.append(text.view(), 0, text.rows());
+  std::fill(ALL(ones.value_), 1.0f);
+  vector<uint8_t > block;
+  encode_block(ones.view(), 0, ones.rows(), false, block);
+  CSRBatch decoded;
+  decoded.clear();
+  compare("block bytes", (int)decode_block(block.data(), decoded),
+          (int)block.size());
+  compare("block without values", (int)(block.size() < ones.index_.size() * 2), 1);
+  compare("block indices", decoded.index_.data(), ones.index_.data(),
+          (int)ones.index_.size());
+  compare("block values", decoded.value_.data(), ones.value_.data(),
+          (int)ones.value_.size());
+
+  // several blocks, decoded in parallel chunks
+  omp_set_num_threads(3);
+  const bool half_values[] = {false, true};
+  for (bool half : half_values) {
+    convert_svm_to_compressed("test_parallel.txt", "test_parallel.txt.vqz",
+                              true, half, 16);
+    CompressedReader reader("test_parallel.txt.vqz");
+    compare("compressed blocks", (int)reader.header().num_blocks, 7);
+    compare("compressed encoding", (int)reader.header().half_values,
+            (int)half);
+    compare("compressed nnz", (int)reader.header().nnz,
+            (int)text.index_.size());
+    CSRBatch data, loader;
+    load_compressed("test_parallel.txt.vqz", data);
+    compare("compressed rows", data.rows(), text.rows());
+    // two blocks at a time, whatever the size of the team
+    vector<CSRBatch > chunks;
+    loader.clear();
+    size_type calls = 0;
+    while (reader.read_parallel(loader, chunks, 2) > 0)
+      calls++;
+    compare("compressed loader calls", calls, 4);
+    compare("compressed loader rows", loader.rows(), text.rows());
+    vector<int > offset(ALL(data.offset_));
+    vector<int > offset_(ALL(text.offset_));
+    vector<int > label_offset(ALL(data.label_offset_));
+    vector<int > label_offset_(ALL(text.label_offset_));
+    compare("compressed offsets", offset.data(), offset_.data(),
+            text.rows() + 1);
+    compare("compressed label offsets", label_offset.data(),
+            label_offset_.data(), text.rows() + 1);
+    compare("compressed indices", data.index_.data(), text.index_.data(),
+            (int)text.index_.size());
+    compare("compressed labels", data.label_.data(), text.label_.data(),
+            (int)text.label_.size());
+    compare("compressed values", data.value_.data(), text.value_.data(),
+            (int)text.value_.size());
+  }
+
+  // streamed with the prefetching reader
+  SparseData stream("test_parallel.txt.vqz", 64, true);
+  compare("stream num_items", stream.getNumItems(), 100);
+  CSRView view;
+  int rows = 0;
+  while (stream.nextBatch(view))
+    rows += view.rows;
+  compare("stream rows", rows, 100);
+}
+
+int main() {
+  write_svm();
+  test_mapped_csr();
+  test_prefetch();
+  test_parser();
+  test_parallel_parser();
+  test_shuffled_dataset();
+  test_feature_map();
+  test_half();
+  test_compressed();
+}
@@ -0,0 +1,94 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <cstdint>
+#include "test.h"
+
+template <Activation Act, bool Select>
+class HeldLayer : public Layer<Act, Select> {
+ public:
+  HeldLayer(size_type I, size_type O) : Layer<Act, Select>(I, O) {}
+  RowClaims& claims() { return this->weight_claims_; }
+};
+
+int main() {
+  std::cout << "Start Testing Hogwild Updates" << std::endl;
+  T* p = aligned_array<T >(3);
+  compare("aligned array", (int)(reinterpret_cast<uintptr_t>(p) % CACHE_LINE), 0);
+  p[0] = 1.5;
+  hogwild_add(p, 0.25);
+  compare("hogwild add", p[0], (T)1.75);
+  std::free(p);
+
+  hogwild_stats(/*reset*/true);
+  RowClaims claims(4);
+  compare("claim free row", (int)claims.claim(2), 1);
+  compare("claim held row", (int)claims.claim(2), 0);
+  compare("claim other row", (int)claims.claim(3), 1);
+  claims.release(2);
+  compare("claim released row", (int)claims.claim(2), 1);
+  HogwildStats stats = hogwild_stats(/*reset*/true);
+  compare("updates counted", (int)stats.updates, 4);
+  compare("conflicts counted", (int)stats.conflicts, 1);
+
+  // a row held by another writer is deferred to apply()
+  vector<T>  x_  = { 0.1357047994833403, -0.9500842332443221 };
+  vector<T>  w_  = { 0.12282730752559588, 1.901416969226425,
+                     -1.573997496240008, 0.20564681374665741 };
+  vector<T>  b_  = { -1.2207054473768937, 1.5676540439571955 };
+  vector<T>  g_  = { 1.7100876807416627, -0.0916384140982638 };
+  vector<T>  update_w_  = { 0.0996205969441981, 1.9026605464874424,
+                            -1.4115247619462077, 0.19694039250722994 };
+  size_type I = 2, O = 2;
+  Optimizer optimizer = {0.1, false};
+  HeldLayer<ReLu, false> layer(I, O);
+  layer.initialize(w_, b_);
+  SparseVector x = x_, g = g_;
+
+  layer.claims().claim(1);
+  layer.backward(g, x, optimizer, true);
+  layer.claims().release(1);
+  compare("free row in place", update_w_.data(), layer.weight(), O);
+  compare("held row deferred", w_.data() + O, layer.weight() + O, O);
+  layer.apply(optimizer);
+  compare("held row applied", update_w_.data(), layer.weight(), I*O);
+  compare("conflict counted", (int)hogwild_stats().conflicts, 1);
+
+  // only the rows touched by a thread get a gradient, summed over the
+  // threads and stepped once per row
+  omp_set_num_threads(3);
+  const size_type rows = 10000, width = 3;
+  GradientAccumulator accumulator(rows, width);
+  vector<T > param(rows * width, 1), param_(rows * width, 1);
+#pragma omp parallel for schedule(static, 1)
+  for (int t = 0; t < 3; ++t) {
+    T* first = accumulator.row(t);
+    for (size_type r = t; r < rows; r += 7) {
+      accumulator.row(r)[r % width] += 1;
+      accumulator.row(t)[0] += 1;
+    }
+    accumulator.row(rows - 1)[2] += t + 1;
+    first[1] = first == accumulator.row(t) ? 1 : -1;
+  }
+  for (int t = 0; t < 3; ++t) {
+    for (size_type r = t; r < rows; r += 7) {
+      param_[r * width + r % width] += 1;
+      param_[t * width] += 1;
+    }
+    param_[t * width + 1] = 2;
+  }
+  param_[(rows - 1) * width + 2] += 6;
+  int steps = 0;
+  auto step = [&](size_type r, const T* grad) {
+    for (size_type k = 0; k < width; ++k)
+      param[r * width + k] += grad[k];
+#pragma omp atomic
+    ++steps;
+  };
+  accumulator.apply(step);
+  compare("touched rows applied", (int)(param == param_), 1);
+  // rows t + 7k of the three threads and the last row they all touch
+  compare("one step per row", steps, (int)(3 * ((rows + 6) / 7) + 1));
+  accumulator.apply(step);
+  compare("gradients reset", (int)(param == param_), 1);
+}
@@ -0,0 +1,67 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <fstream>
+#include "test.h"
+#include "../include/csr_data.h"
+#include "../include/network.h"
+
+const char* SVM_FILE = "test_network.txt";
+
+void write_svm() {
+  std::ofstream file(SVM_FILE);
+  file << "200 1000 50\n";
+  for (int r = 0; r < 200; ++r) {
+    file << r % 50;
+    for (int f = 0; f < 4 + r % 7; ++f)
+      file << " " << (r % 50) * 20 + f << ":" << 1 + f * 0.25;
+    file << "\n";
+  }
+}
+
+int main() {
+  std::cout << "Start Testing Network" << std::endl;
+  write_svm();
+  omp_set_num_threads(3);
+  // the test split is parsed once and predicted through views
+  CSRBatch data;
+  load_svm(SVM_FILE, true, data);
+  const SparseBatch split = data.view();
+  compare("split rows", (int)split.rows, 200);
+
+  const int batch_size = 16;
+  int layer_size[] = {32, 50};
+  Optimizer optimizer = {0.1, false};
+  Network net(layer_size, 2, batch_size, optimizer, 1000);
+  for (int epoch = 0; epoch < 5; ++epoch) {
+    for (size_type b = 0; b < split.rows; b += batch_size)
+      net.train(split.slice(b, batch_size));
+  }
+
+  // the whole split in one parallel loop
+  const int whole = net.predict(split);
+  compare("trained", (int)(whole > 0), 1);
+  compare("repeated whole split", net.predict(split), whole);
+
+  // slices of batches as EvalDataCSR does, the last one is clipped
+  int sliced = 0;
+  for (size_type b = 0; b < split.rows; b += 3 * batch_size)
+    sliced += net.predict(split.slice(b, 3 * batch_size));
+  compare("sliced split", sliced, whole);
+
+  // rows fewer than the threads are predicted a row at a time
+  int rows = 0;
+  for (size_type b = 0; b < split.rows; b += 2)
+    rows += net.predict(split.slice(b, 2));
+  compare("row by row split", rows, whole);
+
+  // only the dense layers have a precision
+  int pq_size[] = {300};
+  bool rejected = false;
+  try {
+    Network pq(pq_size, 1, batch_size, optimizer, 1000, BF16);
+  } catch (const std::runtime_error&) {
+    rejected = true;
+  }
+  compare("precision without dense layer", (int)rejected, 1);
+}
@@ -0,0 +1,89 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <cmath>
+#include "test.h"
+
+void test_adagrad() {
+  Optimizer optimizer = {0.1, false};
+  optimizer.method = Adagrad;
+  OptimizerState state(4, 2);
+  StateRow row = state.touch(optimizer, 3);
+  compare("adagrad first step", state.delta(optimizer, row, 1, 2.0), (T)-0.1);
+  // sum of squares 4 + 9
+  compare("adagrad second step", state.delta(optimizer, row, 1, 3.0),
+          (T)(-0.1 * 3 / std::sqrt(13.)));
+  row = state.touch(optimizer, 2);
+  compare("adagrad other row", state.delta(optimizer, row, 1, -0.5), (T)0.1);
+}
+
+void test_adam() {
+  Optimizer optimizer = {0.1, true};
+  optimizer.method = Adam;
+  OptimizerState state(4, 2);
+  StateRow row = state.touch(optimizer, 0);
+  // the bias correction makes the first step lr * sign(g)
+  compare("adam first step", state.delta(optimizer, row, 0, 0.5), (T)-0.1);
+  state.tick();
+  state.tick();
+  state.tick();
+  // m and v of the two steps without gradient decay before step 4
+  row = state.touch(optimizer, 0);
+  const T beta1 = optimizer.beta1, beta2 = optimizer.beta2;
+  T m = 0.1 * 0.5 * std::pow(beta1, 2);
+  T v = 0.001 * 0.25 * std::pow(beta2, 2);
+  m = beta1 * m;
+  v = beta2 * v;
+  T step = 0.1 * std::sqrt(1 - std::pow(beta2, 4)) / (1 - std::pow(beta1, 4));
+  compare("adam lazy catch up", state.delta(optimizer, row, 0, 0.0),
+          -step * m / std::sqrt(v));
+}
+
+void test_touches_in_step() {
+  const T beta1 = 0.9, beta2 = 0.999, eps = 1e-8;
+  // in Hogwild mode every touch of a row is a step of the row
+  Optimizer optimizer = {0.1, false};
+  optimizer.method = Adam;
+  OptimizerState hogwild(4, 2);
+  hogwild.delta(optimizer, hogwild.touch(optimizer, 1), 0, 0.5);
+  StateRow row = hogwild.touch(optimizer, 1);
+  T m = beta1 * (1 - beta1) * 0.5 + (1 - beta1) * 1.0;
+  T v = beta2 * (1 - beta2) * 0.25 + (1 - beta2) * 1.0;
+  T step = 0.1 * std::sqrt(1 - beta2 * beta2) / (1 - beta1 * beta1);
+  compare("hogwild second touch", hogwild.delta(optimizer, row, 0, 1.0),
+          -step * m / (std::sqrt(v) + eps));
+
+  // with accumulate the touches of a step are summed and stepped once
+  optimizer.accumulate = true;
+  OptimizerState state(4, 2);
+  GradientAccumulator grad(4, 2);
+  vector<T > param(8, 0);
+  grad.row(1)[0] += 0.5;
+  grad.row(1)[0] += 1.0;
+  grad.apply(param.data(), optimizer, state);
+  state.tick();
+  compare("one step of the summed gradient", param[2], (T)-0.1);
+  compare("no gradient no step", param[3], (T)0);
+  grad.row(1)[0] += 1.0;
+  grad.apply(param.data(), optimizer, state);
+  state.tick();
+  m = beta1 * (1 - beta1) * 1.5 + (1 - beta1) * 1.0;
+  v = beta2 * (1 - beta2) * 2.25 + (1 - beta2) * 1.0;
+  compare("second step", param[2], (T)(-0.1 - step * m / std::sqrt(v)));
+}
+
+void test_sgd() {
+  Optimizer optimizer = {0.1, false};
+  OptimizerState state(4, 2);
+  StateRow row = state.touch(optimizer, 1);
+  compare("sgd keeps no state", (int)(row.s == nullptr), 1);
+  compare("sgd step", state.delta(optimizer, row, 0, 2.0), (T)-0.2);
+}
+
+int main() {
+  std::cout << "Start Testing Optimizers" << std::endl;
+  test_sgd();
+  test_adagrad();
+  test_adam();
+  test_touches_in_step();
+}
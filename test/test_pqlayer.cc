@@ -37,6 +37,205 @@ void test_pq(int seed) {
   compare("RQ backward gx", gx, gx_);
 }
 
+/**
+ * \brief more outputs than codewords and a sparse input, backward_x
+ *        sums g per codeword before the dot with the codebook columns
+ */
+template <Activation Act, bool Select, bool NQ>
+void test_pq_wide(int seed) {
+  const size_type I = 32, O = 300;
+  PQLayer<Act, Select, NQ> layer(I, O);
+  FakeLayer<Act, Select> fake(layer);
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx, g;
+  for (int i = 0; i < I; ++i) {
+    T v = distribution(generator);
+    if (i % 4 != 1)
+      sx.push_back(i, v);
+  }
+  for (int o = 0; o < O; ++o) {
+    g.push_back(o, distribution(generator));
+  }
+
+  compare("wide forward", layer.forward(sx), fake.forward(sx));
+  compare("wide backward gx", layer.backward_x(g, sx),
+          fake.backward_x(g, sx));
+}
+
+/**
+ * \brief codes blocked by 16 outputs, the last block padded, against the
+ *        [O_, M_] layout through the updates and code reassignments
+ */
+template <bool NQ>
+void test_pq_blocked(int seed) {
+  const size_type I = 32, O = 300;
+  PQLayer<SoftMax, true, NQ> layer(I, O);
+  PQLayer<SoftMax, true, NQ, 2, 256, uint8_t, 16> blocked(I, O);
+  FakeLayer<SoftMax, true> fake(blocked);
+  Optimizer optimizer = {0.1};
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx, g;
+  for (int i = 0; i < I; ++i) {
+    T v = distribution(generator);
+    if (i % 3 != 2)
+      sx.push_back(i, v);
+  }
+  for (int o = 0; o < O; o += 7) {
+    g.push_back(o, distribution(generator) - 0.5f);
+  }
+
+  compare("blocked forward", blocked.forward(sx), layer.forward(sx));
+  compare("blocked get_w", blocked.forward(sx), fake.forward(sx));
+  for (int t = 0; t < 20; ++t) {
+    layer_random().seed(seed + t);
+    layer.backward(g, sx, optimizer, true);
+    layer_random().seed(seed + t);
+    blocked.backward(g, sx, optimizer, true);
+  }
+  compare("blocked updated forward", blocked.forward(sx), layer.forward(sx));
+  compare("blocked backward gx", blocked.backward_x(g, sx),
+          layer.backward_x(g, sx));
+}
+
+/**
+ * \brief a scan wide enough to be split over the threads agrees with the
+ *        one of a single thread, inside a parallel region
+ */
+template <Activation Act, bool Select, size_type Block>
+void test_pq_sharded(int seed) {
+  const size_type I = 32, O = 5 * SHARD_OUTPUTS / 2 + 3;
+  PQLayer<Act, Select, true, 2, 256, uint8_t, Block> layer(I, O);
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx;
+  for (int i = 0; i < I; ++i) {
+    T v = distribution(generator) - (Act == ReLu ? 0.5f : 0.f);
+    if (i % 3 != 2)
+      sx.push_back(i, v);
+  }
+
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(4);
+  compare("sharded threads", scan_threads(O), 2);
+  SparseVector single;
+#pragma omp parallel num_threads(2)
+  {
+#pragma omp single
+    single = layer.forward(sx);
+  }
+  compare("sharded forward", layer.forward(sx), single);
+  layer.quantize();
+#pragma omp parallel num_threads(2)
+  {
+#pragma omp single
+    single = layer.infer(sx);
+  }
+  compare("sharded infer", layer.infer(sx), single);
+  omp_set_num_threads(threads);
+}
+
+/**
+ * \brief the pruned top k scan of infer selects the same outputs as the
+ *        scan of all of them
+ */
+template <bool NQ, size_type Block>
+void test_pq_pruned(int seed) {
+  const size_type I = 32, O = 64 * 256;
+  PQLayer<SoftMax, true, NQ, 2, 256, uint8_t, Block> layer(I, O);
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  for (int t = 0; t < 3; ++t) {
+    SparseVector sx;
+    for (int i = 0; i < I; ++i) {
+      T v = distribution(generator) - 0.5f;
+      if (i % 3 != t)
+        sx.push_back(i, v);
+    }
+    layer.quantize();
+    layer.prune(false);
+    const SparseVector all = layer.infer(sx);
+    layer.prune(true);
+    compare("pruned infer", layer.infer(sx), all);
+    if constexpr (NQ)
+      compare("pruned forward", layer.infer(sx), layer.forward(sx));
+  }
+}
+
+/**
+ * \brief a small top k keeps the labels in training, scored like the
+ *        other outputs
+ */
+template <size_type Block>
+void test_pq_labeled(int seed) {
+  const size_type I = 32, O = 300;
+  PQLayer<SoftMax, true, true, 2, 256, uint8_t, Block> layer(I, O);
+  FakeLayer<SoftMax, true> fake(layer);
+  TopK top_k;
+  top_k.k = 5;
+  layer.top_k(top_k);
+  fake.top_k(top_k);
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx;
+  for (int i = 0; i < I; ++i) {
+    if (i % 3 != 2)
+      sx.push_back(i, distribution(generator));
+  }
+  const SparseVector top = layer.forward(sx);
+  compare("top k size", (int)top.size(), 5);
+
+  // one label selected anyway and two left out, given unsorted
+  vector<size_type > labels;
+  for (size_type o = O - 1; labels.size() < 2; --o) {
+    if (std::find(top.index_.begin(), top.index_.end(), o)
+        == top.index_.end())
+      labels.push_back(o);
+  }
+  labels.push_back(top.index_[2]);
+  const SparseVector y = layer.forward_labeled(sx, labels.data(), 3);
+  compare("labeled size", (int)y.size(), 7);
+  compare("labeled forward", y,
+          fake.forward_labeled(sx, labels.data(), 3));
+}
+
+template <Activation Act, bool Select, bool NQ>
+void test_pq_dense(int seed) {
+  const size_type I = 16, O = 16;
+  PQLayer<Act, Select, NQ> layer(I, O), layer_(I, O);
+  Optimizer optimizer = {0.1};
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sparse, g;
+  for (int i = 0; i < I; ++i) {
+    T v = distribution(generator);
+    if (i % 3 != 0)
+      sparse.push_back(i, v);
+  }
+  for (int o = 0; o < O; ++o) {
+    g.push_back(o, distribution(generator));
+  }
+  SparseVector dense = sparse;
+  dense.densify(I);
+
+  compare("dense forward", layer.forward(dense), layer_.forward(sparse));
+  // zero inputs must not receive gradient
+  layer_random().seed(seed);
+  SparseVector gx = layer.backward(g, dense, optimizer, true);
+  layer_random().seed(seed);
+  SparseVector gx_ = layer_.backward(g, sparse, optimizer, true);
+  compare("dense backward gx", gx, gx_);
+  compare("dense updated forward", layer.forward(dense),
+          layer_.forward(sparse));
+}
+
 int main() {
   int i = 1016;
   test_pq<Activation::ReLu, true, true>(i++);
@@ -48,4 +247,26 @@ int main() {
   test_pq<Activation::SoftMax, true, false>(i++);
   test_pq<Activation::SoftMax, false, true>(i++);
   test_pq<Activation::SoftMax, false, false>(i++);
+
+  test_pq_wide<Activation::ReLu, false, true>(i++);
+  test_pq_wide<Activation::ReLu, false, false>(i++);
+
+  test_pq_blocked<true>(i++);
+  test_pq_blocked<false>(i++);
+
+  test_pq_sharded<Activation::ReLu, false, 0>(i++);
+  test_pq_sharded<Activation::SoftMax, true, 0>(i++);
+  test_pq_sharded<Activation::SoftMax, true, 16>(i++);
+
+  test_pq_pruned<true, 0>(i++);
+  test_pq_pruned<true, 16>(i++);
+  test_pq_pruned<false, 0>(i++);
+  test_pq_pruned<false, 16>(i++);
+
+  test_pq_labeled<0>(i++);
+  test_pq_labeled<16>(i++);
+
+  test_pq_dense<Activation::ReLu, false, true>(i++);
+  test_pq_dense<Activation::ReLu, false, false>(i++);
+  test_pq_dense<Activation::SoftMax, true, false>(i++);
 }
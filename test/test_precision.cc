@@ -0,0 +1,115 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <string>
+#include "test.h"
+#include "../include/precision.h"
+
+template <typename W>
+void test_rounding(const std::string& name) {
+  const float f = 1.0f + 1.0f / 3000;  // between two 16-bit values
+  compare(name + " nearest", to_float(from_float<W >(f)), 1.0f);
+  double sum = 0;
+  const int n = 100000;
+  for (int i = 0; i < n; ++i)
+    sum += to_float(round_stochastic<W >(f));
+  // unbiased on average, unlike round to nearest
+  compare(name + " stochastic mean",
+          (int)(std::abs(sum / n - f) < 0.05 * (f - 1)), 1);
+  compare(name + " stochastic negative",
+          (int)(to_float(round_stochastic<W >(-f)) < 0), 1);
+}
+
+template <typename W>
+void test_kernels(const std::string& name, SimdLevel level) {
+  const size_type n = 37;
+  std::default_random_engine generator(1016);
+  std::uniform_real_distribution<T > distribution(-1.0, 1.0);
+  vector<T > x(n), y(n);
+  vector<W > w(n);
+  vector<size_type > index(n);
+  for (int k = 0; k < n; ++k) {
+    x[k] = distribution(generator);
+    y[k] = distribution(generator);
+    w[k] = from_float<W >(distribution(generator));
+    index[k] = (k * 7) % n;
+  }
+  T dot_ = 0, sparse_dot_ = 0;
+  vector<T > axpy_ = y;
+  for (int k = 0; k < n; ++k) {
+    dot_ += x[k] * to_float(w[k]);
+    sparse_dot_ += x[k] * to_float(w[index[k]]);
+    axpy_[k] += 0.5f * to_float(w[k]);
+  }
+  set_simd_level(level);
+  const std::string kernel = name + " " + std::to_string(simd_level());
+  axpy(n, 0.5, w.data(), y.data());
+  compare(kernel + " axpy", y.data(), axpy_.data(), n);
+  compare(kernel + " dot", dot(n, x.data(), w.data()), dot_);
+  compare(kernel + " sparse_dot",
+          sparse_dot(n, index.data(), x.data(), w.data()), sparse_dot_);
+
+  // stochastic rounding of the update stays unbiased in the kernels
+  const size_type m = 65539;
+  vector<W > ones(m, from_float<W >(1));
+  vector<T > step(m, 1.0f / 3000);
+  axpy_round(m, 1, step.data(), ones.data());
+  double sum = 0;
+  for (int k = 0; k < m; ++k)
+    sum += to_float(ones[k]) - 1;
+  compare(kernel + " axpy_round", (int)(std::abs(sum / m * 3000 - 1) < 0.1), 1);
+}
+
+// 16-bit weights are within a relative 2^-8 of the fp32 ones
+void compare_close(const std::string& name, const SparseVector& a,
+                   const SparseVector& b) {
+  bool success = a.size() == b.size();
+  for (int i = 0; success && i < a.size(); ++i)
+    success = std::abs(a.value_[i] - b.value_[i])
+      < 0.01 * std::abs(b.value_[i]) + 0.001;
+  compare(name, (int)success, 1);
+}
+
+template <typename W>
+void test_layer(const std::string& name) {
+  const size_type I = 24, O = 20;
+  Layer<ReLu, false> full(I, O);
+  Layer<ReLu, false, W> layer(I, O);
+  vector<T > w(I * O), b(full.bias(), full.bias() + O);
+  for (int k = 0; k < I * O; ++k)
+    w[k] = to_float(layer.weight()[k]);
+  full.initialize(w, b);  // the same rounded weights
+  Optimizer optimizer = {0.1, false};
+
+  SparseVector x, g;
+  for (int i = 1; i < I; i += 3)
+    x.push_back(i, 0.1f * i);
+  for (int o = 0; o < O; o += 2)
+    g.push_back(o, 0.05f * o - 0.3f);
+  compare(name + " layer forward", layer.forward(x), full.forward(x));
+  compare(name + " layer backward_x", layer.backward_x(g, x),
+          full.backward_x(g, x));
+  layer.backward_w(g, x, optimizer);
+  full.backward_w(g, x, optimizer);
+  compare_close(name + " layer updated forward", layer.forward(x),
+                full.forward(x));
+}
+
+int main() {
+  std::cout << "Start Testing Parameter Precision" << std::endl;
+  test_rounding<half_t >("half");
+  test_rounding<bfloat16_t >("bfloat16");
+  // every thread has its own rounding stream
+  vector<uint32_t > bits(2);
+#pragma omp parallel for num_threads(2) schedule(static, 1)
+  for (int t = 0; t < 2; ++t)
+    bits[t] = rounding_bits();
+  compare("threads round apart", (int)(bits[0] != bits[1]), 1);
+  for (SimdLevel level : {SimdScalar, SimdAVX2, SimdAVX512}) {
+    test_kernels<half_t >("half", level);
+    test_kernels<bfloat16_t >("bfloat16", level);
+  }
+  set_simd_level(SimdAVX512);
+  test_layer<half_t >("half");
+  test_layer<bfloat16_t >("bfloat16");
+}
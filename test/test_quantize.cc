@@ -0,0 +1,120 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include <string>
+#include "test.h"
+#include "../include/simd.h"
+
+// int8 products are within about 1% of the largest fp32 term
+void compare_close(const std::string& name, SparseRow a, SparseRow b,
+                   T tolerance) {
+  bool success = a.size() == b.size();
+  for (int i = 0; success && i < a.size(); ++i)
+    success = a.index_[i] == b.index_[i] &&
+      std::abs(a.value_[i] - b.value_[i]) < tolerance;
+  compare(name, (int)success, 1);
+}
+
+void test_kernels(SimdLevel level) {
+  const size_type n = 45;
+  vector<int8_t > q0(n), q1(n);
+  vector<int32_t > acc(n, 3), acc_(n);
+  for (int k = 0; k < n; ++k) {
+    q0[k] = static_cast<int8_t>((k * 37) % 255 - 127);
+    q1[k] = static_cast<int8_t>(127 - (k * 53) % 255);
+    acc_[k] = 3 - 127 * q0[k] + 45 * q1[k];
+  }
+  set_simd_level(level);
+  accumulate_int8(n, -127, q0.data(), 45, q1.data(), acc.data());
+  bool success = acc == acc_;
+  compare("accumulate_int8 " + std::to_string(simd_level()), (int)success, 1);
+}
+
+void test_fast_scan_kernel(SimdLevel level) {
+  const size_type m = 5, n = 45;  // odd m, last block half full
+  vector<uint8_t > code(n * m), lut(m * 16);
+  for (int k = 0; k < n * m; ++k)
+    code[k] = static_cast<uint8_t>((k * 7 + k / 3) % 16);
+  for (int k = 0; k < m * 16; ++k)
+    lut[k] = static_cast<uint8_t>((k * 37) % 256);
+  PackedCodes4 packed;
+  packed.build(code.data(), n, m);
+
+  set_simd_level(level);
+  bool success = packed.blocks == 2;
+  uint16_t sum[PackedCodes4::BLOCK];
+  for (size_type b = 0; b < packed.blocks; ++b) {
+    fast_scan_block(m, packed.block(b), lut.data(), sum);
+    for (size_type j = 0; j < PackedCodes4::BLOCK; ++j) {
+      const size_type o = b * PackedCodes4::BLOCK + j;
+      int expected = 0;
+      for (size_type s = 0; s < m; ++s)
+        expected += lut[s * 16 + (o < n ? code[o * m + s] : 0)];
+      success = success && sum[j] == expected;
+    }
+  }
+  compare("fast_scan_block " + std::to_string(simd_level()), (int)success, 1);
+}
+
+void test_matrix() {
+  vector<T > w = { 0.5, -0.25, 0.125, 0, 0, 0, 2, -1, 0.001 };
+  Int8Matrix matrix;
+  matrix.build(w.data(), 3, 3);
+  compare("int8 row scale", matrix.scale[0], (T)(0.5 / 127));
+  compare("int8 zero row", matrix.scale[1], (T)0);
+  compare("int8 row max", (int)matrix.q[6], 127);
+  compare("int8 row min", (int)matrix.q[7], -64);
+}
+
+void test_layer() {
+  const size_type I = 40, O = 36;
+  Layer<ReLu, false> layer(I, O);
+  SparseVector x;
+  for (int i = 1; i < I; i += 3)
+    x.push_back(i, 0.1f * i);
+  compare_close("layer forward untouched", layer.infer(x), layer.forward(x),
+                1e-6);
+  layer.quantize();
+  compare_close("layer int8 infer", layer.infer(x), layer.forward(x), 0.05);
+}
+
+void test_pq() {
+  const size_type I = 32, O = 300;
+  PQLayer<SoftMax, false, false> layer(I, O);
+  SparseVector x;
+  for (int i = 0; i < I; i += 2)
+    x.push_back(i, 0.05f * i);
+  layer.quantize();
+  compare_close("pq uint8 tables", layer.infer(x), layer.forward(x), 0.001);
+
+  // the uint8 tables gathered a block of outputs at a time
+  PQLayer<SoftMax, false, false, 2, 256, uint8_t, 16> blocked(I, O);
+  blocked.quantize();
+  compare_close("pq blocked uint8 tables", blocked.infer(x),
+                blocked.forward(x), 0.001);
+}
+
+void test_pq_fast_scan() {
+  const size_type I = 32, O = 300;
+  PQLayer<SoftMax, false, false, 8, 16> layer(I, O);
+  SparseVector x;
+  for (int i = 0; i < I; i += 2)
+    x.push_back(i, 0.05f * i);
+  layer.quantize();
+  compare_close("pq 4-bit fast scan", layer.infer(x), layer.forward(x),
+                0.001);
+}
+
+int main() {
+  std::cout << "Start Testing Int8 Inference" << std::endl;
+  test_kernels(SimdScalar);
+  test_kernels(SimdAVX2);
+  test_kernels(SimdAVX512);
+  test_fast_scan_kernel(SimdScalar);
+  test_fast_scan_kernel(SimdAVX2);
+  set_simd_level(SimdAVX512);
+  test_matrix();
+  test_layer();
+  test_pq();
+  test_pq_fast_scan();
+}
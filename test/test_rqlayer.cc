@@ -34,6 +34,34 @@ void test_rq(int seed) {
   compare("RQ backward gx", gx, gx_);
 }
 
+/**
+ * \brief codes blocked by 16 outputs against the [O_, M_] layout through
+ *        the code reassignments of backward_w
+ */
+void test_rq_blocked(int seed) {
+  const size_type I = 16, O = 40;
+  RQLayer<SoftMax, false, false> layer(I, O);
+  RQLayer<SoftMax, false, false, 2, 256, uint8_t, 16> blocked(I, O);
+  Optimizer optimizer = {0.1};
+
+  std::default_random_engine generator(seed);
+  std::uniform_real_distribution<T > distribution(0.0, 1.0);
+  SparseVector sx, g;
+  for (int i = 0; i < I; ++i) {
+    sx.push_back(i, distribution(generator));
+  }
+  for (int o = 0; o < O; o += 3) {
+    g.push_back(o, distribution(generator) - 0.5f);
+  }
+
+  compare("RQ blocked forward", blocked.forward(sx), layer.forward(sx));
+  layer.backward(g, sx, optimizer, true);
+  blocked.backward(g, sx, optimizer, true);
+  compare("RQ blocked updated forward", blocked.forward(sx),
+          layer.forward(sx));
+  compare("RQ blocked get_w", blocked.get_w(3, 39), layer.get_w(3, 39));
+}
+
 int main() {
   int i = 808;
   test_rq<Activation::ReLu, true, true>(i++);
@@ -45,4 +73,6 @@ int main() {
   test_rq<Activation::SoftMax, true, false>(i++);
   test_rq<Activation::SoftMax, false, false>(i++);
   test_rq<Activation::SoftMax, true, true>(i++);
+
+  test_rq_blocked(i++);
 }
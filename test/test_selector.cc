@@ -10,7 +10,10 @@ int main() {
   int id = 100;
   selector.insert(id++, 0.1);
   selector.insert(id++, 0.7);
+  compare("threshold not full",
+          selector.threshold(), std::numeric_limits<float>::lowest());
   selector.insert(1, 200);
+  compare("threshold", selector.threshold(), 0.1f);
   selector.insert(0, 100);
   selector.insert(id++, 0.0);
   selector.insert(id++, 0.5);
@@ -0,0 +1,94 @@
+//
+// Created by xinyan on 17/10/2026.
+//
+#include "test.h"
+#include "../include/simd.h"
+
+void test_kernels(SimdLevel level) {
+  const size_type n = 37, dim = 100;
+  std::default_random_engine generator(1016);
+  std::uniform_real_distribution<T > distribution(-1.0, 1.0);
+  vector<T > x(dim), y(dim);
+  for (int k = 0; k < dim; ++k) {
+    x[k] = distribution(generator);
+    y[k] = distribution(generator);
+  }
+  vector<size_type > index(n);
+  for (int k = 0; k < n; ++k)
+    index[k] = (k * 7) % dim;
+
+  set_simd_level(SimdScalar);
+  vector<T > axpy_ = y, sparse_axpy_ = y;
+  axpy(n, 0.5, x.data(), axpy_.data());
+  sparse_axpy(n, 0.5, index.data(), x.data(), sparse_axpy_.data());
+  T dot_ = dot(n, x.data(), y.data());
+  T sparse_dot_ = sparse_dot(n, index.data(), x.data(), y.data());
+  // two subspaces of tables of 50 entries, codes [2, n]
+  vector<uint8_t > code(2 * n);
+  for (int k = 0; k < 2 * n; ++k)
+    code[k] = static_cast<uint8_t>((k * 13) % 50);
+  vector<T > gather_(n), gather_scaled_(n);
+  gather_sum(n, 2, code.data(), n, x.data(), 50, y.data(), gather_.data());
+  gather_sum(n, 2, code.data(), n, x.data(), 50, y.data(), x.data(),
+             gather_scaled_.data());
+  // uint8 tables, padded for the 32-bit loads of the gathers
+  vector<uint8_t > lut(2 * 50 + 3);
+  for (int k = 0; k < lut.size(); ++k)
+    lut[k] = static_cast<uint8_t>(k * 37);
+  vector<int32_t > gather_u8_(n);
+  gather_sum(n, 2, code.data(), n, lut.data(), 50, gather_u8_.data());
+
+  std::string name = set_simd_level(level) == level
+    ? std::to_string(level) : "unsupported, scalar";
+  vector<T > axpy_v = y, sparse_axpy_v = y;
+  axpy(n, 0.5, x.data(), axpy_v.data());
+  sparse_axpy(n, 0.5, index.data(), x.data(), sparse_axpy_v.data());
+  compare("axpy " + name, axpy_v.data(), axpy_.data(), dim);
+  compare("sparse_axpy " + name, sparse_axpy_v.data(), sparse_axpy_.data(), dim);
+  vector<T > gather_v(n), gather_scaled_v(n);
+  gather_sum(n, 2, code.data(), n, x.data(), 50, y.data(), gather_v.data());
+  gather_sum(n, 2, code.data(), n, x.data(), 50, y.data(), x.data(),
+             gather_scaled_v.data());
+  compare("gather_sum " + name, gather_v.data(), gather_.data(), n);
+  compare("scaled gather_sum " + name, gather_scaled_v.data(),
+          gather_scaled_.data(), n);
+  vector<int32_t > gather_u8_v(n);
+  gather_sum(n, 2, code.data(), n, lut.data(), 50, gather_u8_v.data());
+  compare("uint8 gather_sum " + name, gather_u8_v.data(), gather_u8_.data(),
+          n);
+  compare("dot " + name, dot(n, x.data(), y.data()), dot_);
+  compare("sparse_dot " + name,
+          sparse_dot(n, index.data(), x.data(), y.data()), sparse_dot_);
+}
+
+void test_layer(SimdLevel level) {
+  using Generic = StaticLayer<Layer<ReLu, false>, ReLu, false>;
+  const size_type I = 24, O = 20;
+  Layer<ReLu, false> layer(I, O);
+  Optimizer optimizer = {0.1};
+  set_simd_level(level);
+
+  SparseVector x, g;
+  for (int i = 1; i < I; i += 3)
+    x.push_back(i, 0.1f * i);
+  for (int o = 0; o < O; o += 2)
+    g.push_back(o, 0.05f * o - 0.3f);
+  compare("layer forward", layer.forward(x), layer.Generic::forward(x));
+  compare("layer backward_x", layer.backward_x(g, x),
+          layer.Generic::backward_x(g, x));
+
+  vector<T > w_(layer.weight(), layer.weight() + I * O);
+  for (int s = 0; s < x.size(); ++s)
+    for (int o = 0; o < g.size(); ++o)
+      w_[x.index_[s] * O + g.index_[o]] -= 0.1f * x.value_[s] * g.value_[o];
+  layer.backward_w(g, x, optimizer);
+  compare("layer backward_w", layer.weight(), (const T*)w_.data(), I * O);
+}
+
+int main() {
+  std::cout << "detected simd level " << simd_level() << std::endl;
+  test_kernels(SimdAVX2);
+  test_kernels(SimdAVX512);
+  test_layer(SimdScalar);
+  test_layer(simd_level());
+}
@@ -82,8 +82,109 @@ void test_smm_softmax() {
 
 }
 
+void test_smm_dense() {
+  size_type I = 8, O = 4;
+  Layer<SoftMax, false> layer(I, O);
+  SparseVector sparse;
+  sparse.push_back(1, 0.5);
+  sparse.push_back(4, 2.0);
+  sparse.push_back(7, 0.25);
+  SparseVector dense = sparse;
+  dense.densify(I);
+
+  compare("dense size", (int)dense.size(), 8);
+  compare("dense forward", layer.forward(dense), layer.forward(sparse));
+}
+
+void test_smm_sharded() {
+  size_type I = 8, O = 2 * SHARD_OUTPUTS + 5;
+  Layer<SoftMax, true> layer(I, O);
+  SparseVector x;
+  x.push_back(1, 0.5);
+  x.push_back(4, 2.0);
+  x.push_back(7, -0.25);
+
+  const int threads = omp_get_max_threads();
+  omp_set_num_threads(2);
+  SparseVector single;
+#pragma omp parallel num_threads(2)
+  {
+#pragma omp single
+    single = layer.forward(x);
+  }
+  compare("sharded forward", layer.forward(x), single);
+  layer.quantize();
+#pragma omp parallel num_threads(2)
+  {
+#pragma omp single
+    single = layer.infer(x);
+  }
+  compare("sharded infer", layer.infer(x), single);
+  omp_set_num_threads(threads);
+}
+
+void test_smm_mass() {
+  size_type I = 8, O = 40;
+  Layer<SoftMax, true> layer(I, O);
+  SparseVector x;
+  x.push_back(1, 0.5);
+  x.push_back(4, 2.0);
+  x.push_back(7, -0.25);
+  TopK top_k;
+  top_k.k = 20;
+  layer.top_k(top_k);
+  const SparseVector all = layer.forward(x);
+  const size_type label = all.index_[std::min_element(
+    all.value_.begin(), all.value_.end()) - all.value_.begin()];
+
+  // the largest probabilities until half of the mass, and the label
+  top_k.mass = 0.5;
+  layer.top_k(top_k);
+  const SparseVector y = layer.forward_labeled(x, &label, 1);
+  vector<T > kept(y.value_.begin(), y.value_.end());
+  std::sort(kept.begin(), kept.end(), std::greater<T >());
+  T sum = 0;
+  for (int i = 0; i + 2 < kept.size(); ++i)
+    sum += kept[i];
+  compare("mass kept",
+          (int)(sum < 0.5f && sum + kept[kept.size() - 2] >= 0.5f), 1);
+  compare("mass label",
+          (int)std::count(y.index_.begin(), y.index_.end(), label), 1);
+}
+
+void test_smm_minibatch() {
+  size_type I = 2, O = 2;
+  vector<T>  x_  = { 0.1357047994833403, -0.9500842332443221 };
+  vector<T>  w_  = { 0.12282730752559588, 1.901416969226425,
+                     -1.573997496240008, 0.20564681374665741 };
+  vector<T>  b_  = { -1.2207054473768937, 1.5676540439571955 };
+  vector<T>  g_  = { 1.7100876807416627, -0.0916384140982638 };
+  vector<T>  update_w_  = { 0.0996205969441981, 1.9026605464874424,
+                            -1.4115247619462077, 0.19694039250722994 };
+  vector<T>  update_b_  = { -1.39171421545106, 1.5768178853670218 };
+
+  Optimizer optimizer = {0.1, true};
+  Layer<ReLu, false> layer(I, O);
+  layer.initialize(w_, b_);
+  SparseVector x = x_, g = g_;
+
+  layer.backward(g, x, optimizer, true);
+  // the update waits for apply()
+  compare("minibatch deferred w", w_, layer.weight(), I*O);
+  compare("minibatch deferred b", b_, layer.bias(), O);
+  layer.apply(optimizer);
+  compare("minibatch update_w", update_w_, layer.weight(), I*O);
+  compare("minibatch update_b", update_b_, layer.bias(), O);
+  layer.apply(optimizer);
+  compare("minibatch applied once", update_w_, layer.weight(), I*O);
+}
+
 int main() {
   std::cout << "Start Testing Sparse Matrix Multiplication Layer" << std::endl;
   test_smm_relu();
   test_smm_softmax();
+  test_smm_dense();
+  test_smm_sharded();
+  test_smm_mass();
+  test_smm_minibatch();
 }
@@ -69,10 +69,34 @@ void test_residual_kmeans() {
   compare("rq code", codes.data(), r_codes_.data(), r_codes_.size());
 }
 
+void test_vq_transposed() {
+  const size_type m = 2, ks = 16, d = 8;
+  std::default_random_engine generator(1016);
+  std::uniform_real_distribution<T > distribution(-1.0, 1.0);
+  vector<T > dict(m * ks * d), dict_t(m * ks * d), w(d);
+  for (T& v : dict)
+    v = distribution(generator);
+  transpose_codebook(dict_t.data(), dict.data(), m, ks, d);
+  compare("transposed", dict_t[(1 * d + 3) * ks + 5],
+          dict[(1 * ks + 5) * d + 3]);
+
+  vector<size_type > codes, codes_;
+  for (int t = 0; t < 8; ++t) {
+    for (T& v : w)
+      v = distribution(generator);
+    for (int i = 0; i < m; ++i) {
+      codes.push_back(vq(w.data(), &dict[i * ks * d], ks, d));
+      codes_.push_back(vq_transposed(w.data(), &dict_t[i * ks * d], ks, d));
+    }
+  }
+  compare("vq transposed", codes.data(), codes_.data(), codes.size());
+}
+
 int main() {
   test_l2dist();
   test_normalize();
   test_kmeans();
   test_residual_kmeans();
+  test_vq_transposed();
   return 0;
 }